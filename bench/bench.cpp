@@ -0,0 +1,1022 @@
+#include "token.h"
+#include "parser.h"
+#include "flattree.h"
+#include "tokenscan.h"
+#include "incremental.h"
+#include "treebin.h"
+#include "fold.h"
+#include "hashcons.h"
+#include "interner.h"
+#include "vm.h"
+#include "native.h"
+#include "treeeval.h"
+#include "suite.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+template <typename F>
+static double bestOf(int iterations, F&& body) {
+    double best = 1e300;
+    for (int i = 0; i < iterations; i++) {
+        Clock::time_point start = Clock::now();
+        body();
+        double elapsed = chrono::duration<double>(Clock::now() - start).count();
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+static void report(const string& name, double pointerTime, double flatTime) {
+    cout << "  " << name << ": BinTree " << pointerTime * 1000 << " ms, FlatTree "
+        << flatTime * 1000 << " ms (x" << pointerTime / flatTime << ")" << endl;
+}
+
+// Same walks the parser runs over its own subtrees, applied to every
+// FUNC_CALL node of the whole tree.
+static int countArgumentsBin(STNode* node) {
+    int count = 0;
+    NodeStack stack;
+    stack.push(node);
+    while (!stack.isEmpty()) {
+        STNode* current = stack.pop();
+        if (current->getData().type != "SEQ") {
+            count++;
+        }
+        else {
+            stack.push(current->getRight());
+            stack.push(current->getLeft());
+        }
+    }
+    return count;
+}
+
+static long long walkBin(const BinTree& tree, bool countCalls) {
+    long long total = 0;
+    NodeStack stack;
+    stack.push(tree.getRoot());
+    while (!stack.isEmpty()) {
+        STNode* node = stack.pop();
+        if (countCalls) {
+            if (node->getData().type == "FUNC_CALL" && node->getRight()) {
+                total += countArgumentsBin(node->getRight());
+            }
+        }
+        else {
+            total += node->getData().value.size() + 1;
+        }
+        stack.push(node->getRight());
+        stack.push(node->getLeft());
+    }
+    return total;
+}
+
+static long long walkFlat(const FlatTree& tree, bool countCalls) {
+    long long total = 0;
+    for (int i = 0; i < tree.size(); i++) {
+        if (countCalls) {
+            if (tree.kind(i) == NODE_FUNC_CALL && tree.right(i) >= 0) {
+                total += tree.countArguments(tree.right(i));
+            }
+        }
+        else {
+            total += tree.text(i).size() + 1;
+        }
+    }
+    return total;
+}
+
+// program stress; var x: integer; begin x := x + 1; ... end.
+static TokenArray makeStressTokens(int statements) {
+    TokenArray tokens;
+    tokens.reserve(statements * 6 + 16);
+    tokens.emplace_back(1, TOKEN_KEYWORD, "program");
+    tokens.emplace_back(1, TOKEN_ID, "stress");
+    tokens.emplace_back(1, TOKEN_SEP, ";");
+    tokens.emplace_back(2, TOKEN_KEYWORD, "var");
+    tokens.emplace_back(2, TOKEN_ID, "x");
+    tokens.emplace_back(2, TOKEN_SEP, ":");
+    tokens.emplace_back(2, TOKEN_KEYWORD, "integer");
+    tokens.emplace_back(2, TOKEN_SEP, ";");
+    tokens.emplace_back(3, TOKEN_KEYWORD, "begin");
+    for (int i = 0; i < statements; i++) {
+        int line = i + 4;
+        tokens.emplace_back(line, TOKEN_ID, "x");
+        tokens.emplace_back(line, TOKEN_SEP, ":=");
+        tokens.emplace_back(line, TOKEN_ID, "x");
+        tokens.emplace_back(line, TOKEN_SEP, "+");
+        tokens.emplace_back(line, TOKEN_DECNUM, "1");
+        tokens.emplace_back(line, TOKEN_SEP, ";");
+    }
+    tokens.emplace_back(statements + 4, TOKEN_KEYWORD, "end");
+    tokens.emplace_back(statements + 4, TOKEN_SEP, ".");
+    return tokens;
+}
+
+// Parses, writes and drops one program whose main block is a single SEQ
+// chain of the given length; any recursion along the chain would overflow.
+static int runStress(int statements) {
+    TokenArray tokens = makeStressTokens(statements);
+    cout << "Stress: " << statements << " statements, " << tokens.size() << " tokens" << endl;
+
+    Clock::time_point start = Clock::now();
+    Parser* parser = new Parser(tokens);
+    parser->parse();
+    double parseTime = chrono::duration<double>(Clock::now() - start).count();
+
+    start = Clock::now();
+    ostringstream out;
+    parser->getST()->write(out);
+    double writeTime = chrono::duration<double>(Clock::now() - start).count();
+
+    start = Clock::now();
+    delete parser;
+    double teardownTime = chrono::duration<double>(Clock::now() - start).count();
+
+    cout << "  parse " << parseTime * 1000 << " ms (" << tokens.size() / parseTime / 1e6 << " Mtokens/s)" << endl;
+    cout << "  write " << writeTime * 1000 << " ms (" << out.str().size() << " bytes)" << endl;
+    cout << "  teardown " << teardownTime * 1000 << " ms" << endl;
+    return 0;
+}
+
+// program decls; var g0, ..., g9: integer; ... function f0(a, b, c: integer;
+// var d: integer): integer; begin f0 := a end; ... begin g0 := 1 end.
+// Token values point into names, which must outlive the returned array.
+static TokenArray makeDeclTokens(int variables, int functions, vector<string>& names) {
+    static const char* const params[] = { "a", "b", "c", "d" };
+    TokenArray tokens;
+    tokens.reserve(variables * 2 + functions * 24 + 16);
+    tokens.emplace_back(1, TOKEN_KEYWORD, "program");
+    tokens.emplace_back(1, TOKEN_ID, "decls");
+    tokens.emplace_back(1, TOKEN_SEP, ";");
+    tokens.emplace_back(2, TOKEN_KEYWORD, "var");
+
+    names.clear();
+    names.reserve(variables + functions);
+    for (int i = 0; i < variables; i++) names.push_back("g" + to_string(i));
+    for (int i = 0; i < functions; i++) names.push_back("f" + to_string(i));
+
+    int line = 3;
+    for (int i = 0; i < variables; i++) {
+        tokens.emplace_back(line, TOKEN_ID, names[i]);
+        if (i % 10 == 9 || i + 1 == variables) {
+            tokens.emplace_back(line, TOKEN_SEP, ":");
+            tokens.emplace_back(line, TOKEN_KEYWORD, "integer");
+            tokens.emplace_back(line, TOKEN_SEP, ";");
+            line++;
+        }
+        else {
+            tokens.emplace_back(line, TOKEN_SEP, ",");
+        }
+    }
+    for (int i = 0; i < functions; i++, line++) {
+        string_view name = names[variables + i];
+        tokens.emplace_back(line, TOKEN_KEYWORD, "function");
+        tokens.emplace_back(line, TOKEN_ID, name);
+        tokens.emplace_back(line, TOKEN_SEP, "(");
+        for (int p = 0; p < 3; p++) {
+            tokens.emplace_back(line, TOKEN_ID, params[p]);
+            tokens.emplace_back(line, TOKEN_SEP, p < 2 ? "," : ":");
+        }
+        tokens.emplace_back(line, TOKEN_KEYWORD, "integer");
+        tokens.emplace_back(line, TOKEN_SEP, ";");
+        tokens.emplace_back(line, TOKEN_KEYWORD, "var");
+        tokens.emplace_back(line, TOKEN_ID, params[3]);
+        tokens.emplace_back(line, TOKEN_SEP, ":");
+        tokens.emplace_back(line, TOKEN_KEYWORD, "integer");
+        tokens.emplace_back(line, TOKEN_SEP, ")");
+        tokens.emplace_back(line, TOKEN_SEP, ":");
+        tokens.emplace_back(line, TOKEN_KEYWORD, "integer");
+        tokens.emplace_back(line, TOKEN_SEP, ";");
+        tokens.emplace_back(line, TOKEN_KEYWORD, "begin");
+        tokens.emplace_back(line, TOKEN_ID, name);
+        tokens.emplace_back(line, TOKEN_SEP, ":=");
+        tokens.emplace_back(line, TOKEN_ID, params[0]);
+        tokens.emplace_back(line, TOKEN_KEYWORD, "end");
+        tokens.emplace_back(line, TOKEN_SEP, ";");
+    }
+    tokens.emplace_back(line, TOKEN_KEYWORD, "begin");
+    tokens.emplace_back(line, TOKEN_ID, "g0");
+    tokens.emplace_back(line, TOKEN_SEP, ":=");
+    tokens.emplace_back(line, TOKEN_DECNUM, "1");
+    tokens.emplace_back(line, TOKEN_KEYWORD, "end");
+    tokens.emplace_back(line, TOKEN_SEP, ".");
+    return tokens;
+}
+
+// Reports how many tree nodes and arena bytes each declaration costs.
+static int runDecls(int variables) {
+    if (variables < 1) variables = 1;
+    int functions = variables / 10;
+    vector<string> names;
+    TokenArray tokens = makeDeclTokens(variables, functions, names);
+    int declarations = variables + functions * 5;
+    cout << "Declarations: " << variables << " variables, " << functions
+        << " functions with 4 parameters, " << tokens.size() << " tokens" << endl;
+
+    Clock::time_point start = Clock::now();
+    Parser parser(tokens);
+    parser.parse();
+    double parseTime = chrono::duration<double>(Clock::now() - start).count();
+
+    NodeArena& arena = parser.getST()->getArena();
+    cout << "  parse " << parseTime * 1000 << " ms" << endl;
+    cout << "  " << arena.nodesAllocated() << " nodes, " << arena.bytesUsed() << " arena bytes" << endl;
+    cout << "  per declaration: " << (double)arena.nodesAllocated() / declarations << " nodes, "
+        << (double)arena.bytesUsed() / declarations << " bytes" << endl;
+    return 0;
+}
+
+static bool sameTokens(const TokenArray& a, const TokenArray& b) {
+    if (a.size() != b.size()) return false;
+    for (int i = 0; i < a.size(); i++) {
+        if (a[i].line != b[i].line || a[i].kind != b[i].kind ||
+            a[i].lexeme != b[i].lexeme || a[i].value != b[i].value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Throughput of the text token scanners over one mapped file.
+static int runScan(const string& filename, int iterations) {
+    MappedFile file(filename);
+    const char* begin = file.begin();
+    const char* end = file.end();
+    double gigabytes = file.size() / 1e9;
+    cout << "Scan: " << file.size() << " bytes, block scanner uses " << tokenScanKind() << endl;
+
+    int lines = 0;
+    double countTime = bestOf(iterations, [&] { lines = countLines(begin, end); });
+
+    TokenArray byLine, blocks;
+    double lineTime = bestOf(iterations, [&] {
+        byLine.clear();
+        byLine.reserve(lines + 1);
+        scanTokenTextByLine(begin, end, byLine);
+    });
+    double blockTime = bestOf(iterations, [&] {
+        blocks.clear();
+        blocks.reserve(lines + 1);
+        scanTokenText(begin, end, blocks);
+    });
+
+    cout << "  count lines: " << countTime * 1000 << " ms, " << gigabytes / countTime << " GB/s (" << lines << " lines)" << endl;
+    cout << "  memchr + parseTokenLine: " << lineTime * 1000 << " ms, " << gigabytes / lineTime << " GB/s" << endl;
+    cout << "  block scanner: " << blockTime * 1000 << " ms, " << gigabytes / blockTime << " GB/s (x"
+        << lineTime / blockTime << ")" << endl;
+
+    if (!sameTokens(byLine, blocks)) {
+        cerr << "ERROR: block scanner tokens differ from parseTokenLine" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Reloading a saved binary tree against loading and parsing the tokens
+// again, plus the cost of writing either tree format.
+static int runTreeBinary(const string& filename, int iterations) {
+    string textFile = filename + ".tree.txt";
+    string binaryFile = filename + ".tree.bin";
+
+    TokenArray tokens = loadTokens(filename, false);
+    Parser parser(tokens);
+    parser.setVerbose(false);
+    parser.parse();
+    const BinTree& tree = *parser.getST();
+    cout << "Tree: " << tokens.size() << " tokens, "
+        << parser.getST()->getArena().nodesAllocated() << " nodes" << endl;
+
+    double reparseTime = bestOf(iterations, [&] {
+        TokenArray again = loadTokens(filename, false);
+        Parser other(again);
+        other.setVerbose(false);
+        other.parse();
+    });
+    double textTime = bestOf(iterations, [&] { tree.saveToFile(textFile); });
+    double saveTime = bestOf(iterations, [&] { saveTreeBinary(tree, binaryFile); });
+    BinTree reloaded;
+    double loadTime = bestOf(iterations, [&] { loadTreeBinary(binaryFile, reloaded); });
+
+    ifstream textIn(textFile, ios::binary | ios::ate);
+    ifstream binaryIn(binaryFile, ios::binary | ios::ate);
+    cout << "  write text: " << textTime * 1000 << " ms (" << textIn.tellg() << " bytes)" << endl;
+    cout << "  write binary: " << saveTime * 1000 << " ms (" << binaryIn.tellg() << " bytes)" << endl;
+    cout << "  load tokens + parse: " << reparseTime * 1000 << " ms" << endl;
+    cout << "  load binary tree: " << loadTime * 1000 << " ms (x" << reparseTime / loadTime << ")" << endl;
+    textIn.close();
+    binaryIn.close();
+    remove(textFile.c_str());
+    remove(binaryFile.c_str());
+
+    ostringstream expected, actual;
+    tree.write(expected);
+    reloaded.write(actual);
+    if (expected.str() != actual.str()) {
+        cerr << "ERROR: reloaded tree differs from the parsed one" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Copy of tokens with edit applied, taking the inserted tokens from
+// inserted. addedLines moves every later token down that many lines.
+static TokenArray applyEdit(const TokenArray& tokens, const TokenEdit& edit, const Token* inserted, int addedLines) {
+    TokenArray result(tokens);
+    result.clear();
+    result.reserve(tokens.size() + edit.inserted);
+    for (int i = 0; i < edit.start; i++) result.push_back(tokens[i]);
+    for (int i = 0; i < edit.inserted; i++) result.push_back(inserted[i]);
+    for (int i = edit.start + edit.removed; i < tokens.size(); i++) {
+        Token token = tokens[i];
+        token.line += addedLines;
+        result.push_back(token);
+    }
+    return result;
+}
+
+static string treeText(BinTree& tree, const TokenArray& tokens) {
+    ostringstream out;
+    FlatTree flat(tree, tokens);
+    flat.write(out);
+    return out.str();
+}
+
+// Single-line edits spread over a program, each applied with
+// IncrementalParser::update: a number changed in place, and a simple
+// assignment copied onto a new line before itself and deleted again.
+static int runIncremental(const string& filename, int edits) {
+    TokenArray tokens = loadTokens(filename, false);
+
+    Clock::time_point start = Clock::now();
+    IncrementalParser session(tokens, 1);
+    double fullTime = chrono::duration<double>(Clock::now() - start).count();
+
+    // "id := ... ;" with no block inside, starting right after a ';'.
+    vector<int> numbers, assignments;
+    for (int i = 1; i + 1 < tokens.size(); i++) {
+        if (tokens[i].kind == TOKEN_DECNUM) numbers.push_back(i);
+        if (tokens[i - 1].lexeme == SEP_SEMICOLON && tokens[i].kind == TOKEN_ID &&
+            tokens[i + 1].lexeme == SEP_ASSIGN) {
+            assignments.push_back(i);
+        }
+    }
+    if (numbers.empty() || assignments.empty()) {
+        cerr << "ERROR: no numbers or assignments to edit" << endl;
+        return 1;
+    }
+    cout << "Incremental: " << tokens.size() << " tokens, last line " << tokens[tokens.size() - 1].line
+        << ", full parse " << fullTime * 1000 << " ms" << endl;
+
+    static const char* const digits[] = { "1", "22", "333", "4444" };
+    // Only updates that reparsed one piece count towards the averages.
+    double changeTime = 0, insertTime = 0, deleteTime = 0, worst = 0, fallbackTime = 0;
+    int changes = 0, inserts = 0, deletes = 0, fallbacks = 0;
+    auto timed = [&](const TokenArray& next, const TokenEdit& edit, double& total, int& count) {
+        Clock::time_point begin = Clock::now();
+        bool incremental = session.update(next, edit);
+        double elapsed = chrono::duration<double>(Clock::now() - begin).count();
+        if (!incremental) {
+            fallbackTime += elapsed;
+            fallbacks++;
+            return;
+        }
+        total += elapsed;
+        count++;
+        if (elapsed > worst) worst = elapsed;
+    };
+
+    for (int e = 0; e < edits; e++) {
+        if (e % 2 == 0) {
+            int at = numbers[(size_t)e * 7919 % numbers.size()];
+            Token number(tokens[at].line, TOKEN_DECNUM, digits[e / 2 % 4]);
+            TokenEdit edit(at, 1, 1);
+            tokens = applyEdit(tokens, edit, &number, 0);
+            timed(tokens, edit, changeTime, changes);
+        }
+        else {
+            int at = assignments[(size_t)e * 7919 % assignments.size()];
+            int end = at;
+            while (end < tokens.size() && tokens[end].lexeme != SEP_SEMICOLON &&
+                tokens[end].kind != TOKEN_KEYWORD) {
+                end++;
+            }
+            if (end == tokens.size() || tokens[end].lexeme != SEP_SEMICOLON) continue;
+            int length = end + 1 - at;
+
+            vector<Token> copy;
+            for (int i = at; i <= end; i++) copy.push_back(tokens[i]);
+            TokenEdit insert(at, 0, length);
+            tokens = applyEdit(tokens, insert, copy.data(), 1);
+            timed(tokens, insert, insertTime, inserts);
+
+            TokenEdit remove(at, length, 0);
+            tokens = applyEdit(tokens, remove, nullptr, -1);
+            timed(tokens, remove, deleteTime, deletes);
+        }
+    }
+
+    cout << "  change a number: " << changeTime / (changes ? changes : 1) * 1e6 << " us (" << changes << ")" << endl;
+    cout << "  insert a line: " << insertTime / (inserts ? inserts : 1) * 1e6 << " us (" << inserts << ")" << endl;
+    cout << "  delete it again: " << deleteTime / (deletes ? deletes : 1) * 1e6 << " us (" << deletes << ")" << endl;
+    cout << "  slowest: " << worst * 1e6 << " us" << endl;
+    cout << "  full reparse (edit outside a piece): " << fallbackTime / (fallbacks ? fallbacks : 1) * 1000
+        << " ms (" << fallbacks << ")" << endl;
+
+    Clock::time_point settleStart = Clock::now();
+    session.getST();
+    cout << "  getST() moving kept subtrees: "
+        << chrono::duration<double>(Clock::now() - settleStart).count() * 1000 << " ms" << endl;
+
+    Parser full(tokens);
+    full.setVerbose(false);
+    full.parse();
+    if (!session.getST() || treeText(*session.getST(), tokens) != treeText(*full.getST(), tokens)) {
+        cerr << "ERROR: incremental tree differs from a full parse" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// An error-heavy corpus: copies of the input with one token deleted each,
+// spread evenly, parsed through parse() and its exception and through
+// tryParse(), which formats nothing unless asked.
+static int runErrors(const string& filename, int variants, int iterations) {
+    TokenArray tokens = loadTokens(filename, false);
+    if (tokens.empty()) throw runtime_error("No tokens loaded");
+    vector<TokenArray> corpus;
+    for (int i = 0; i < variants; i++) {
+        int position = (int)((long long)i * tokens.size() / variants);
+        corpus.push_back(applyEdit(tokens, TokenEdit(position, 1, 0), nullptr, 0));
+    }
+
+    vector<string> thrown(corpus.size());
+    double throwTime = bestOf(iterations, [&] {
+        for (size_t i = 0; i < corpus.size(); i++) {
+            Parser parser(corpus[i]);
+            parser.setVerbose(false);
+            try {
+                parser.parse();
+                thrown[i].clear();
+            }
+            catch (const exception& e) {
+                thrown[i] = e.what();
+            }
+        }
+    });
+
+    int failures = 0;
+    double checkTime = bestOf(iterations, [&] {
+        failures = 0;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            Parser parser(corpus[i]);
+            parser.setVerbose(false);
+            if (!parser.tryParse()) failures++;
+        }
+    });
+
+    vector<string> formatted(corpus.size());
+    double formatTime = bestOf(iterations, [&] {
+        for (size_t i = 0; i < corpus.size(); i++) {
+            Parser parser(corpus[i]);
+            parser.setVerbose(false);
+            formatted[i].clear();
+            if (!parser.tryParse()) formatted[i] = "Parsing failed: " + parser.getDiagnostics().front().message(true);
+        }
+    });
+
+    double files = (double)corpus.size();
+    cout << "Errors: " << corpus.size() << " files of " << tokens.size() << " tokens, "
+        << failures << " with errors" << endl;
+    cout << "  parse() + catch: " << throwTime * 1000 << " ms, " << files / throwTime << " files/s" << endl;
+    cout << "  tryParse(): " << checkTime * 1000 << " ms, " << files / checkTime << " files/s (x"
+        << throwTime / checkTime << ")" << endl;
+    cout << "  tryParse() + message(): " << formatTime * 1000 << " ms, " << files / formatTime << " files/s" << endl;
+
+    if (formatted != thrown) {
+        cerr << "ERROR: formatted diagnostics differ from parse()'s exceptions" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+static long long countReachable(const BinTree& tree) {
+    long long count = 0;
+    NodeStack stack;
+    stack.push(tree.getRoot());
+    while (!stack.isEmpty()) {
+        STNode* node = stack.pop();
+        count++;
+        stack.push(node->getRight());
+        stack.push(node->getLeft());
+    }
+    return count;
+}
+
+// The folding pass, and writing the tree before and after it.
+static int runFold(const string& filename, int iterations) {
+    TokenArray tokens = loadTokens(filename, false);
+    string treeFile = filename + ".tree.txt";
+
+    FoldStats stats;
+    long long before = 0, after = 0;
+    double foldTime = 1e300, plainWrite = 1e300, foldedWrite = 1e300;
+    for (int i = 0; i < iterations; i++) {
+        Parser parser(tokens);
+        parser.setVerbose(false);
+        parser.parse();
+        BinTree& tree = *parser.getST();
+        before = countReachable(tree);
+        plainWrite = min(plainWrite, bestOf(1, [&] { tree.saveToFile(treeFile); }));
+        foldTime = min(foldTime, bestOf(1, [&] { stats = foldConstants(tree); }));
+        after = countReachable(tree);
+        foldedWrite = min(foldedWrite, bestOf(1, [&] { tree.saveToFile(treeFile); }));
+    }
+    remove(treeFile.c_str());
+
+    cout << "Fold: " << tokens.size() << " tokens, " << stats.literals << " literals, "
+        << stats.substituted << " constants substituted, " << stats.folded << " operations folded, "
+        << stats.kept << " kept" << endl;
+    cout << "  fold: " << foldTime * 1000 << " ms" << endl;
+    cout << "  nodes: " << before << " -> " << after << " (" << stats.removed << " removed)" << endl;
+    cout << "  write text: " << plainWrite * 1000 << " ms -> " << foldedWrite * 1000 << " ms" << endl;
+
+    if (before - after != stats.removed) {
+        cerr << "ERROR: removed nodes do not match the tree" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Appends the space-separated words of text as tokens on one line.
+// Token values point into names, which must outlive the tokens.
+static void addTokens(TokenArray& tokens, deque<string>& names, int line, const string& text) {
+    static const char* const keywords[] = { "program", "var", "function", "begin", "end", "integer", "div", "writeln" };
+    istringstream words(text);
+    string word;
+    while (words >> word) {
+        int kind = TOKEN_ID;
+        if (isdigit((unsigned char)word[0])) kind = TOKEN_DECNUM;
+        else if (!isalpha((unsigned char)word[0])) kind = TOKEN_SEP;
+        else if (find(begin(keywords), end(keywords), word) != end(keywords)) kind = TOKEN_KEYWORD;
+        names.push_back(word);
+        tokens.emplace_back(line, kind, names.back());
+    }
+}
+
+// The add/multiply fixture scaled up: f1 calls add and multiply, which
+// takes a var parameter, and each fk calls f(k-1) twice, so running
+// f<levels> makes about 2^(levels+1) calls.
+static TokenArray makeCallTokens(int levels, deque<string>& names) {
+    TokenArray tokens;
+    int line = 1;
+    addTokens(tokens, names, line++, "program calls ; var a , c : integer ;");
+    addTokens(tokens, names, line++, "function add ( x , y : integer ) : integer ; begin add := x + y end ;");
+    addTokens(tokens, names, line++, "function multiply ( var m : integer ; n : integer ) : integer ;");
+    addTokens(tokens, names, line++, "begin multiply := m * n ; m := m + 1 end ;");
+    addTokens(tokens, names, line++, "function f1 ( x : integer ; var c : integer ) : integer ;");
+    addTokens(tokens, names, line++, "begin f1 := add ( x , multiply ( c , x ) ) end ;");
+    for (int k = 2; k <= levels; k++) {
+        string name = "f" + to_string(k);
+        string callee = "f" + to_string(k - 1);
+        addTokens(tokens, names, line++, "function " + name + " ( x : integer ; var c : integer ) : integer ;");
+        addTokens(tokens, names, line++, "begin " + name + " := " + callee + " ( x , c ) - " + callee +
+            " ( x + 1 , c ) div 3 end ;");
+    }
+    addTokens(tokens, names, line++, "begin c := 1 ; a := f" + to_string(levels) + " ( 7 , c ) ; writeln ( a , c ) end .");
+    return tokens;
+}
+
+// The scaled add/multiply fixture when source is a level count,
+// otherwise the tokens of a lexer.txt or tokens.bin file.
+static TokenArray programTokens(const string& source, deque<string>& names) {
+    bool fixture = !source.empty() && isdigit((unsigned char)source[0]);
+    return fixture ? makeCallTokens(max(1, stoi(source)), names) : loadTokens(source, false);
+}
+
+// What a program prints, followed by the runtime error that stopped it.
+template <typename F>
+static string captureOutput(F&& run) {
+    ostringstream out;
+    try {
+        run(out);
+        return out.str();
+    }
+    catch (const runtime_error& e) {
+        return out.str() + e.what() + "\n";
+    }
+}
+
+// Compiles and runs a program on the VM and on the tree-walking
+// evaluator.
+static int runVm(const string& source, int iterations) {
+    deque<string> names;
+    TokenArray tokens = programTokens(source, names);
+
+    Parser parser(tokens);
+    parser.setVerbose(false);
+    parser.parse();
+    BinTree& tree = *parser.getST();
+    foldConstants(tree);
+
+    Bytecode program;
+    double compileTime = bestOf(iterations, [&] { program = compileProgram(tree); });
+    string vmOutput, treeOutput;
+    double vmTime = bestOf(iterations, [&] {
+        vmOutput = captureOutput([&](ostream& out) { runBytecode(program, out); });
+    });
+    double treeTime = bestOf(iterations, [&] {
+        treeOutput = captureOutput([&](ostream& out) { evaluateTree(tree, out); });
+    });
+
+    size_t calls = 0;
+    for (size_t pc = 0; pc < program.code.size(); pc += 1 + opcodeOperands(program.code[pc])) {
+        if (program.code[pc] == OP_CALL) calls++;
+    }
+    cout << "VM: " << tokens.size() << " tokens, " << program.code.size() << " code words, "
+        << program.functions.size() << " functions, " << calls << " call sites" << endl;
+    cout << "  compile: " << compileTime * 1000 << " ms" << endl;
+    cout << "  bytecode: " << vmTime * 1000 << " ms" << endl;
+    cout << "  tree walk: " << treeTime * 1000 << " ms (x" << treeTime / vmTime << ")" << endl;
+    cout << "  output: " << vmOutput.substr(0, vmOutput.find('\n')) << endl;
+
+    if (vmOutput != treeOutput) {
+        cerr << "ERROR: the VM's output differs from the tree walk's" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// writeln with calls among its arguments that write lines of their own:
+// every argument is evaluated before the line is written, so the callee's
+// lines come first, on the VM and on the tree walk alike.
+static int runCheckWriteln() {
+    deque<string> names;
+    TokenArray tokens;
+    addTokens(tokens, names, 1, "program nested ; var a : integer ;");
+    addTokens(tokens, names, 2, "function f ( x : integer ) : integer ; begin writeln ( x ) ; f := x end ;");
+    addTokens(tokens, names, 3, "begin writeln ( 1 , f ( 2 ) ) ; a := 4 ; writeln ( f ( 3 ) , a , f ( 5 ) ) end .");
+    const string expected = "2\n1 2\n3\n5\n3 4 5\n";
+
+    Parser parser(tokens);
+    parser.setVerbose(false);
+    parser.parse();
+    BinTree& tree = *parser.getST();
+    foldConstants(tree);
+    Bytecode program = compileProgram(tree);
+    string vmOutput = captureOutput([&](ostream& out) { runBytecode(program, out); });
+    string treeOutput = captureOutput([&](ostream& out) { evaluateTree(tree, out); });
+
+    bool ok = true;
+    if (vmOutput != expected) {
+        cerr << "ERROR: the VM wrote:\n" << vmOutput << "expected:\n" << expected;
+        ok = false;
+    }
+    if (treeOutput != expected) {
+        cerr << "ERROR: the tree walk wrote:\n" << treeOutput << "expected:\n" << expected;
+        ok = false;
+    }
+    if (ok) cout << "Nested writeln: OK" << endl;
+    return ok ? 0 : 1;
+}
+
+// Hash-consing on the --decls program with the given number of
+// variables, or on a token file: the reduction, and that the tree and a
+// binary round trip of it write the same text as before. (printST is
+// left out: it indents by depth, so long declaration lists make it
+// quadratic.)
+static int runHashCons(const string& source, int iterations) {
+    vector<string> names;
+    bool generated = !source.empty() && isdigit((unsigned char)source[0]);
+    int variables = generated ? max(1, stoi(source)) : 0;
+    TokenArray tokens = generated ? makeDeclTokens(variables, variables / 10, names) : loadTokens(source, false);
+
+    HashConsStats stats;
+    string before, after, reloaded;
+    double passTime = 1e300;
+    for (int i = 0; i < iterations; i++) {
+        Parser parser(tokens);
+        parser.setVerbose(false);
+        parser.parse();
+        BinTree& tree = *parser.getST();
+        if (i == 0) {
+            ostringstream out;
+            tree.write(out);
+            before = out.str();
+        }
+        passTime = min(passTime, bestOf(1, [&] { stats = hashConsTree(tree); }));
+        if (i == 0) {
+            ostringstream out;
+            tree.write(out);
+            after = out.str();
+
+            string binaryFile = "bench_hashcons.bin";
+            saveTreeBinary(tree, binaryFile);
+            BinTree copy;
+            loadTreeBinary(binaryFile, copy);
+            remove(binaryFile.c_str());
+            ostringstream copyOut;
+            copy.write(copyOut);
+            reloaded = copyOut.str();
+        }
+    }
+
+    cout << "Hash-consing: " << tokens.size() << " tokens, " << stats.occurrences << " nodes in the tree" << endl;
+    cout << "  pass: " << passTime * 1000 << " ms" << endl;
+    cout << "  nodes: " << stats.nodesBefore << " -> " << stats.nodesAfter << " ("
+        << 100.0 * stats.nodesAfter / stats.nodesBefore << "%)" << endl;
+    cout << "  arena bytes: " << stats.bytesBefore << " -> " << stats.bytesAfter << " ("
+        << 100.0 * stats.bytesAfter / stats.bytesBefore << "%)" << endl;
+
+    if (after != before || reloaded != before) {
+        cerr << "ERROR: the hash-consed tree prints differently" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Parses copies of one token file on threads threads, each tree storing
+// its own node text and then all of them sharing one SharedInterner.
+static int runIntern(const string& filename, int threads, int copies) {
+    TokenArray tokens = loadTokens(filename, false);
+    threads = max(1, threads);
+    copies = max(threads, copies);
+
+    struct Run {
+        double seconds;
+        size_t arenaBytes;
+        string text;
+    };
+    auto parseAll = [&](SharedInterner* strings) {
+        Run run{ 0, 0, "" };
+        vector<size_t> bytes(threads, 0);
+        vector<string> texts(threads);
+        Clock::time_point start = Clock::now();
+        vector<thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                for (int i = t; i < copies; i += threads) {
+                    Parser parser(tokens);
+                    parser.setVerbose(false);
+                    parser.setInterner(strings);
+                    parser.parse();
+                    bytes[t] += parser.getST()->getArena().bytesUsed();
+                    if (i == t) {
+                        ostringstream out;
+                        parser.getST()->write(out);
+                        texts[t] = out.str();
+                    }
+                }
+            });
+        }
+        for (thread& worker : workers) worker.join();
+        run.seconds = chrono::duration<double>(Clock::now() - start).count();
+        for (int t = 0; t < threads; t++) {
+            run.arenaBytes += bytes[t];
+            if (texts[t] != texts[0]) run.text = "threads disagree";
+        }
+        if (run.text.empty()) run.text = texts[0];
+        return run;
+    };
+
+    Run own = parseAll(nullptr);
+    SharedInterner strings;
+    Run shared = parseAll(&strings);
+
+    cout << "Interning: " << tokens.size() << " tokens, " << copies << " trees on " << threads << " threads" << endl;
+    cout << "  own text: " << own.seconds * 1000 << " ms, " << own.arenaBytes << " arena bytes" << endl;
+    cout << "  shared:   " << shared.seconds * 1000 << " ms, " << shared.arenaBytes << " arena bytes + "
+        << strings.bytesUsed() << " bytes in " << strings.size() << " distinct strings" << endl;
+
+    if (own.text != shared.text) {
+        cerr << "ERROR: trees with interned text write differently" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+static string readFile(const string& filename) {
+    ifstream in(filename, ios::binary);
+    ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// Writes the program as assembly, builds it with the system's cc and
+// checks that the binary prints what the tree walk does, runtime error
+// included. The VM is compared too, though the binary is lowered from
+// its bytecode and shares any mistake made compiling it. Needs an x86-64
+// System V toolchain; the native time includes starting the process.
+static int runNative(const string& source, int iterations) {
+    deque<string> names;
+    TokenArray tokens = programTokens(source, names);
+    Parser parser(tokens);
+    parser.setVerbose(false);
+    parser.parse();
+    BinTree& tree = *parser.getST();
+    foldConstants(tree);
+    Bytecode program = compileProgram(tree);
+
+    const string base = "bench_native";
+    {
+        ofstream out(base + ".s", ios::binary);
+        if (!out) throw runtime_error("Cannot write file: " + base + ".s");
+        writeAssembly(program, out);
+    }
+    string build = "cc -o " + base + " " + base + ".s";
+    double buildTime = bestOf(1, [&] {
+        if (system(build.c_str()) != 0) throw runtime_error("'" + build + "' failed");
+    });
+
+    string expected = captureOutput([&](ostream& out) { evaluateTree(tree, out); });
+    string vmOutput;
+    double vmTime = bestOf(iterations, [&] {
+        vmOutput = captureOutput([&](ostream& out) { runBytecode(program, out); });
+    });
+    string command = "./" + base + " > " + base + ".out 2> " + base + ".err";
+    int status = 0;
+    double nativeTime = bestOf(iterations, [&] { status = system(command.c_str()); });
+    string actual = readFile(base + ".out") + readFile(base + ".err");
+    for (const char* suffix : { "", ".s", ".out", ".err" }) remove((base + suffix).c_str());
+
+    cout << "Native: " << tokens.size() << " tokens, " << program.functions.size() << " functions" << endl;
+    cout << "  assemble and link: " << buildTime * 1000 << " ms" << endl;
+    cout << "  bytecode: " << vmTime * 1000 << " ms" << endl;
+    cout << "  native: " << nativeTime * 1000 << " ms (x" << vmTime / nativeTime << ")" << endl;
+    cout << "  output: " << actual.substr(0, actual.find('\n')) << endl;
+
+    bool failed = expected.find("Runtime error") != string::npos;
+    int result = 0;
+    if (actual != expected || (status != 0) != failed) {
+        cerr << "ERROR: the native program's output differs from the tree walk's" << endl;
+        result = 1;
+    }
+    if (vmOutput != expected) {
+        cerr << "ERROR: the VM's output differs from the tree walk's" << endl;
+        result = 1;
+    }
+    return result;
+}
+
+// --generate <out.txt> [shape options]: writes one synthetic program.
+static int runGenerate(int argc, char* argv[]) {
+    ProgramShape shape;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (!setShapeOption(shape, argv[i], argv[i + 1])) throw runtime_error(string("Unknown option: ") + argv[i]);
+    }
+    ofstream out(argv[2], ios::binary);
+    if (!out) throw runtime_error(string("Cannot write file: ") + argv[2]);
+    long long tokens = writeProgram(shape, out);
+    cout << "Wrote " << tokens << " tokens to " << argv[2] << endl;
+    return 0;
+}
+
+// --suite [-n iterations] [--baseline file] [--save-baseline file]
+//         [--tolerance percent] [shape options]
+static int runSuiteCommand(int argc, char* argv[]) {
+    SuiteOptions options;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string name = argv[i];
+        string value = argv[i + 1];
+        if (name == "-n") options.iterations = max(1, stoi(value));
+        else if (name == "--baseline") options.baseline = value;
+        else if (name == "--save-baseline") options.saveBaseline = value;
+        else if (name == "--tolerance") options.tolerance = stod(value) / 100;
+        else if (setShapeOption(options.shape, name, value)) options.custom = true;
+        else throw runtime_error("Unknown option: " + name);
+    }
+    return runSuite(options);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <lexer.txt | tokens.bin> [iterations]" << endl;
+        cerr << "       " << argv[0] << " --stress <statements>" << endl;
+        cerr << "       " << argv[0] << " --decls <variables>" << endl;
+        cerr << "       " << argv[0] << " --scan <lexer.txt> [iterations]" << endl;
+        cerr << "       " << argv[0] << " --incremental <lexer.txt> [edits]" << endl;
+        cerr << "       " << argv[0] << " --tree-binary <lexer.txt> [iterations]" << endl;
+        cerr << "       " << argv[0] << " --errors <lexer.txt> [variants] [iterations]" << endl;
+        cerr << "       " << argv[0] << " --fold <lexer.txt> [iterations]" << endl;
+        cerr << "       " << argv[0] << " --hash-cons <variables | lexer.txt> [iterations]" << endl;
+        cerr << "       " << argv[0] << " --intern <lexer.txt> [threads] [copies]" << endl;
+        cerr << "       " << argv[0] << " --vm <levels | lexer.txt> [iterations]" << endl;
+        cerr << "       " << argv[0] << " --check-native <levels | lexer.txt> [iterations]" << endl;
+        cerr << "       " << argv[0] << " --check-writeln" << endl;
+        cerr << "       " << argv[0] << " --generate <out.txt> [shape options]" << endl;
+        cerr << "       " << argv[0] << " --suite [-n iterations] [--baseline file] [--save-baseline file]" << endl;
+        cerr << "             [--tolerance percent] [shape options]" << endl;
+        cerr << "Shape options: --constants --globals --functions --params --function-statements" << endl;
+        cerr << "               --statements --depth --hex <percent> --seed" << endl;
+        return 1;
+    }
+
+    try {
+        if (string(argv[1]) == "--stress") {
+            return runStress(argc > 2 ? stoi(argv[2]) : 1000000);
+        }
+        if (string(argv[1]) == "--decls") {
+            return runDecls(argc > 2 ? stoi(argv[2]) : 100000);
+        }
+        if (string(argv[1]) == "--scan" && argc > 2) {
+            return runScan(argv[2], argc > 3 ? stoi(argv[3]) : 5);
+        }
+        if (string(argv[1]) == "--incremental" && argc > 2) {
+            return runIncremental(argv[2], argc > 3 ? stoi(argv[3]) : 200);
+        }
+        if (string(argv[1]) == "--tree-binary" && argc > 2) {
+            return runTreeBinary(argv[2], argc > 3 ? stoi(argv[3]) : 5);
+        }
+        if (string(argv[1]) == "--errors" && argc > 2) {
+            return runErrors(argv[2], argc > 3 ? stoi(argv[3]) : 1000, argc > 4 ? stoi(argv[4]) : 5);
+        }
+        if (string(argv[1]) == "--fold" && argc > 2) {
+            return runFold(argv[2], argc > 3 ? stoi(argv[3]) : 5);
+        }
+        if (string(argv[1]) == "--hash-cons") {
+            return runHashCons(argc > 2 ? argv[2] : "100000", argc > 3 ? stoi(argv[3]) : 5);
+        }
+        if (string(argv[1]) == "--intern" && argc > 2) {
+            return runIntern(argv[2], argc > 3 ? stoi(argv[3]) : 4, argc > 4 ? stoi(argv[4]) : 16);
+        }
+        if (string(argv[1]) == "--vm") {
+            return runVm(argc > 2 ? argv[2] : "18", argc > 3 ? stoi(argv[3]) : 5);
+        }
+        if (string(argv[1]) == "--check-native") {
+            return runNative(argc > 2 ? argv[2] : "18", argc > 3 ? stoi(argv[3]) : 3);
+        }
+        if (string(argv[1]) == "--check-writeln") {
+            return runCheckWriteln();
+        }
+        if (string(argv[1]) == "--generate" && argc > 2) {
+            return runGenerate(argc, argv);
+        }
+        if (string(argv[1]) == "--suite") {
+            return runSuiteCommand(argc, argv);
+        }
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    int iterations = argc > 2 ? stoi(argv[2]) : 5;
+
+    try {
+        TokenArray tokens = loadTokens(argv[1]);
+        Parser parser(tokens);
+        parser.parse();
+        const BinTree& tree = *parser.getST();
+
+        FlatTree* flat = nullptr;
+        double buildTime = bestOf(iterations, [&] {
+            delete flat;
+            flat = new FlatTree(tree, tokens);
+        });
+        cout << "FlatTree: " << flat->size() << " nodes, built in " << buildTime * 1000 << " ms" << endl;
+
+        long long binNodes = 0, flatNodes = 0, binArgs = 0, flatArgs = 0;
+        double binWalk = bestOf(iterations, [&] { binNodes = walkBin(tree, false); });
+        double flatWalk = bestOf(iterations, [&] { flatNodes = walkFlat(*flat, false); });
+        double binCalls = bestOf(iterations, [&] { binArgs = walkBin(tree, true); });
+        double flatCalls = bestOf(iterations, [&] { flatArgs = walkFlat(*flat, true); });
+
+        string binPrinted, flatPrinted, binWritten, flatWritten;
+        double binPrint = bestOf(iterations, [&] { ostringstream out; tree.printST(out); binPrinted = out.str(); });
+        double flatPrint = bestOf(iterations, [&] { ostringstream out; flat->printST(out); flatPrinted = out.str(); });
+        double binWrite = bestOf(iterations, [&] { ostringstream out; tree.write(out); binWritten = out.str(); });
+        double flatWrite = bestOf(iterations, [&] { ostringstream out; flat->write(out); flatWritten = out.str(); });
+
+        cout << "Traversal (best of " << iterations << "):" << endl;
+        report("visit all nodes", binWalk, flatWalk);
+        report("count call arguments", binCalls, flatCalls);
+        report("printST", binPrint, flatPrint);
+        report("write", binWrite, flatWrite);
+
+        bool same = binNodes == flatNodes && binArgs == flatArgs &&
+            binPrinted == flatPrinted && binWritten == flatWritten;
+        delete flat;
+        if (!same) {
+            cerr << "ERROR: FlatTree output differs from BinTree" << endl;
+            return 1;
+        }
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
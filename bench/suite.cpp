@@ -0,0 +1,228 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// Platform headers go first, as in mappedfile.cpp.
+#include "suite.h"
+#include "parser.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+typedef chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Linux can restart the high-water mark, so each case gets its own peak.
+// Elsewhere the peak is the process's so far.
+static void resetPeakMemory() {
+#ifdef __linux__
+    ofstream clear("/proc/self/clear_refs");
+    if (clear) clear << "5";
+#endif
+}
+
+static long long peakMemoryKB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return (long long)(counters.PeakWorkingSetSize / 1024);
+#else
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return stoll(line.substr(6));
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+struct SuiteCase {
+    string name;
+    ProgramShape shape;
+};
+
+static vector<SuiteCase> presetCases() {
+    vector<SuiteCase> cases;
+
+    SuiteCase flat{ "flat", ProgramShape() };
+    flat.shape.functions = 0;
+    flat.shape.statements = 200000;
+    flat.shape.depth = 2;
+    cases.push_back(flat);
+
+    SuiteCase functions{ "functions", ProgramShape() };
+    functions.shape.functions = 5000;
+    functions.shape.functionStatements = 20;
+    functions.shape.statements = 1000;
+    cases.push_back(functions);
+
+    SuiteCase deep{ "deep", ProgramShape() };
+    deep.shape.depth = 8;
+    deep.shape.statements = 20000;
+    cases.push_back(deep);
+
+    SuiteCase decls{ "decls", ProgramShape() };
+    decls.shape.constants = 20000;
+    decls.shape.globals = 200000;
+    decls.shape.functions = 0;
+    decls.shape.statements = 100;
+    cases.push_back(decls);
+
+    return cases;
+}
+
+// "case metric" -> value, the layout of a baseline file.
+typedef map<string, double> Results;
+
+// Metrics where a higher value is better; for the rest lower is better.
+static bool higherIsBetter(const string& metric) {
+    return metric == "tokens_per_s" || metric == "nodes_per_s";
+}
+
+static void runCase(const SuiteCase& test, int iterations, Results& results) {
+    filesystem::path dir = filesystem::temp_directory_path();
+    string tokensFile = (dir / ("syntax_bench_" + test.name + ".txt")).string();
+    string treeFile = (dir / ("syntax_bench_" + test.name + "_tree.txt")).string();
+
+    long long tokenCount;
+    {
+        ofstream out(tokensFile, ios::binary);
+        if (!out) throw runtime_error("Cannot write file: " + tokensFile);
+        tokenCount = writeProgram(test.shape, out);
+    }
+
+    resetPeakMemory();
+    double load = 1e300, parse = 1e300, save = 1e300, teardown = 1e300;
+    size_t nodes = 0;
+    for (int i = 0; i < iterations; i++) {
+        Clock::time_point start = Clock::now();
+        TokenArray* tokens = new TokenArray(loadTokens(tokensFile, false));
+        load = min(load, secondsSince(start));
+
+        start = Clock::now();
+        Parser* parser = new Parser(*tokens);
+        parser->setVerbose(false);
+        parser->parse();
+        parse = min(parse, secondsSince(start));
+        nodes = parser->getST()->getArena().nodesAllocated();
+
+        start = Clock::now();
+        parser->getST()->saveToFile(treeFile);
+        save = min(save, secondsSince(start));
+
+        start = Clock::now();
+        delete parser;
+        delete tokens;
+        teardown = min(teardown, secondsSince(start));
+    }
+    long long peak = peakMemoryKB();
+    remove(tokensFile.c_str());
+    remove(treeFile.c_str());
+
+    cout << "  " << left << setw(10) << test.name << right << fixed << setprecision(2)
+        << setw(10) << tokenCount << setw(10) << nodes
+        << setw(10) << load * 1000 << setw(10) << parse * 1000
+        << setw(10) << save * 1000 << setw(10) << teardown * 1000
+        << setw(10) << tokenCount / parse / 1e6 << setw(10) << nodes / parse / 1e6
+        << setw(10) << peak / 1024.0 << defaultfloat << endl;
+
+    results[test.name + " load_ms"] = load * 1000;
+    results[test.name + " parse_ms"] = parse * 1000;
+    results[test.name + " save_ms"] = save * 1000;
+    results[test.name + " teardown_ms"] = teardown * 1000;
+    results[test.name + " tokens_per_s"] = tokenCount / parse;
+    results[test.name + " nodes_per_s"] = nodes / parse;
+    results[test.name + " peak_rss_kb"] = (double)peak;
+}
+
+static Results loadBaseline(const string& filename) {
+    ifstream in(filename);
+    if (!in) throw runtime_error("Cannot open baseline: " + filename);
+    Results results;
+    string name, metric;
+    double value;
+    while (in >> name >> metric >> value) results[name + " " + metric] = value;
+    return results;
+}
+
+static void saveBaseline(const string& filename, const Results& results) {
+    ofstream out(filename);
+    if (!out) throw runtime_error("Cannot write baseline: " + filename);
+    out << fixed << setprecision(3);
+    for (const auto& entry : results) out << entry.first << " " << entry.second << "\n";
+}
+
+// Prints every metric that moved by more than tolerance; returns the
+// number of regressions.
+static int compareBaseline(const Results& baseline, const Results& results, double tolerance) {
+    int regressions = 0;
+    cout << "Against baseline (tolerance " << tolerance * 100 << "%):" << endl;
+    for (const auto& entry : results) {
+        auto old = baseline.find(entry.first);
+        if (old == baseline.end() || old->second <= 0) continue;
+        string metric = entry.first.substr(entry.first.find(' ') + 1);
+        double ratio = entry.second / old->second;
+        double worse = higherIsBetter(metric) ? 1 / ratio : ratio;
+        const char* verdict = nullptr;
+        if (worse > 1 + tolerance) {
+            regressions++;
+            verdict = "  REGRESSION ";
+        }
+        else if (worse < 1 / (1 + tolerance)) {
+            verdict = "  improved   ";
+        }
+        if (verdict) {
+            cout << verdict << left << setw(24) << entry.first << right << fixed << setprecision(2)
+                << old->second << " -> " << entry.second << " (" << showpos << (ratio - 1) * 100
+                << noshowpos << "%)" << defaultfloat << endl;
+        }
+    }
+    if (regressions == 0) cout << "  no regressions" << endl;
+    return regressions;
+}
+
+int runSuite(const SuiteOptions& options) {
+    vector<SuiteCase> cases;
+    if (options.custom) cases.push_back(SuiteCase{ "custom", options.shape });
+    else cases = presetCases();
+
+    cout << "Suite (best of " << options.iterations << "; times in ms, rates in millions/s, RSS in MB):" << endl;
+    cout << "  " << left << setw(10) << "case" << right << setw(10) << "tokens" << setw(10) << "nodes"
+        << setw(10) << "load" << setw(10) << "parse" << setw(10) << "save" << setw(10) << "teardown"
+        << setw(10) << "Mtok/s" << setw(10) << "Mnode/s" << setw(10) << "peak" << endl;
+
+    Results results;
+    for (const SuiteCase& test : cases) runCase(test, options.iterations, results);
+
+    if (!options.saveBaseline.empty()) {
+        saveBaseline(options.saveBaseline, results);
+        cout << "Baseline saved to " << options.saveBaseline << endl;
+    }
+    if (!options.baseline.empty()) {
+        return compareBaseline(loadBaseline(options.baseline), results, options.tolerance) ? 1 : 0;
+    }
+    return 0;
+}
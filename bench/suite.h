@@ -0,0 +1,22 @@
+#pragma once
+#include "tokengen.h"
+#include <string>
+
+using namespace std;
+
+struct SuiteOptions {
+    int iterations;
+    bool custom;            // run only shape instead of the preset cases
+    ProgramShape shape;
+    string baseline;        // compare against this file when set
+    string saveBaseline;    // write the results here when set
+    double tolerance;       // allowed slowdown before a metric counts as a regression
+
+    SuiteOptions() : iterations(3), custom(false), tolerance(0.10) {}
+};
+
+// Generates each case into a temporary lexer.txt file and times
+// loadTokens, Parser::parse, BinTree::saveToFile and teardown separately
+// (best of the iterations), with tokens/s, nodes/s and peak RSS. Returns
+// nonzero when a baseline was given and a case got slower than tolerance.
+int runSuite(const SuiteOptions& options);
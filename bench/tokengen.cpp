@@ -0,0 +1,296 @@
+#include "tokengen.h"
+#include "token.h"
+
+namespace {
+
+// xorshift64*: the standard distributions differ between libraries, and
+// baselines must compare the same tokens everywhere.
+class Random {
+private:
+    unsigned long long state;
+
+public:
+    explicit Random(unsigned long long seed) : state(seed * 2654435761ULL + 0x9E3779B97F4A7C15ULL) {
+        if (!state) state = 1;
+    }
+
+    unsigned long long next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    int below(int limit) { return limit > 0 ? (int)(next() % (unsigned long long)limit) : 0; }
+    bool percent(int chance) { return below(100) < chance; }
+};
+
+class ProgramWriter {
+private:
+    const ProgramShape& shape;
+    ostream& out;
+    Random random;
+    string buffer;
+    int line;
+    long long count;
+
+    // Names visible in the function being written; -1 outside functions.
+    int function;
+    int callable;       // functions a call may name
+
+    void put(int kind, const string& value) {
+        buffer += to_string(line);
+        buffer += ' ';
+        buffer += (char)('0' + kind);
+        buffer += ' ';
+        buffer += value;
+        buffer += '\n';
+        count++;
+        if (buffer.size() >= (1 << 16)) flush();
+    }
+
+    void keyword(const char* word) { put(TOKEN_KEYWORD, word); }
+    void sep(const char* text) { put(TOKEN_SEP, text); }
+    void id(const string& name) { put(TOKEN_ID, name); }
+
+    void number() {
+        int value = random.below(1000);
+        if (random.percent(shape.hexPercent)) {
+            static const char digits[] = "0123456789ABCDEF";
+            string text;
+            do {
+                text.insert(text.begin(), digits[value % 16]);
+                value /= 16;
+            } while (value);
+            put(TOKEN_HEXNUM, "$" + text);
+        }
+        else {
+            put(TOKEN_DECNUM, to_string(value));
+        }
+    }
+
+    // Parameters come in groups of three: plain, var, const, and again.
+    static bool varParam(int p) { return p / 3 % 3 == 1; }
+    static bool constParam(int p) { return p / 3 % 3 == 2; }
+
+    // A variable the current code may assign.
+    string target() {
+        if (function >= 0) {
+            int choice = random.below(4);
+            if (choice == 0) return "f" + to_string(function);
+            if (choice == 1 && shape.params > 0) {
+                int p = random.below(shape.params);
+                if (!constParam(p)) return "p" + to_string(p);
+            }
+            if (choice == 2) return "l0";
+        }
+        return "g" + to_string(random.below(shape.globals));
+    }
+
+    void operand() {
+        int choice = random.below(shape.constants > 0 ? 4 : 3);
+        if (choice == 0) number();
+        else if (choice == 3) id("c" + to_string(random.below(shape.constants)));
+        else if (function >= 0 && shape.params > 0 && choice == 1) id("p" + to_string(random.below(shape.params)));
+        else id("g" + to_string(random.below(shape.globals)));
+    }
+
+    void call(int depth) {
+        id("f" + to_string(random.below(callable)));
+        sep("(");
+        for (int i = 0; i < shape.params; i++) {
+            if (i) sep(",");
+            if (varParam(i)) id(target());
+            else expression(depth);
+        }
+        sep(")");
+    }
+
+    void expression(int depth) {
+        if (depth <= 0 || random.percent(30)) {
+            operand();
+            return;
+        }
+        int choice = random.below(10);
+        if (choice < 6) {
+            static const char* const ops[] = { "+", "-", "*", "div" };
+            expression(depth - 1);
+            int op = random.below(4);
+            if (op == 3) keyword(ops[op]);
+            else sep(ops[op]);
+            expression(depth - 1);
+        }
+        else if (choice < 8 || callable == 0) {
+            sep("(");
+            expression(depth - 1);
+            sep(")");
+        }
+        else {
+            call(depth - 1);
+        }
+    }
+
+    void statement(int nesting) {
+        int choice = random.below(20);
+        if (choice < 2 && nesting < 2) {
+            keyword("begin");
+            line++;
+            statement(nesting + 1);
+            statement(nesting + 1);
+            keyword("end");
+            sep(";");
+        }
+        else if (choice < 5) {
+            keyword("writeln");
+            sep("(");
+            expression(shape.depth);
+            sep(",");
+            expression(shape.depth);
+            sep(")");
+            sep(";");
+        }
+        else if (choice < 7 && callable > 0) {
+            call(shape.depth);
+            sep(";");
+        }
+        else {
+            id(target());
+            sep(":=");
+            expression(shape.depth);
+            sep(";");
+        }
+        line++;
+    }
+
+    void functionDec(int index) {
+        keyword("function");
+        id("f" + to_string(index));
+        if (shape.params > 0) {
+            sep("(");
+            for (int p = 0; p < shape.params; p++) {
+                if (p % 3 == 0) {
+                    if (p) sep(";");
+                    if (varParam(p)) keyword("var");
+                    if (constParam(p)) keyword("const");
+                }
+                else {
+                    sep(",");
+                }
+                id("p" + to_string(p));
+                if (p % 3 == 2 || p + 1 == shape.params) {
+                    sep(":");
+                    keyword("integer");
+                }
+            }
+            sep(")");
+        }
+        sep(":");
+        keyword("integer");
+        sep(";");
+        line++;
+
+        keyword("var");
+        id("l0");
+        sep(":");
+        keyword("integer");
+        sep(";");
+        line++;
+
+        function = index;
+        callable = index;
+        keyword("begin");
+        line++;
+        for (int i = 0; i < shape.functionStatements; i++) statement(1);
+        id("f" + to_string(index));
+        sep(":=");
+        expression(shape.depth);
+        line++;
+        keyword("end");
+        sep(";");
+        line++;
+        function = -1;
+    }
+
+public:
+    ProgramWriter(const ProgramShape& s, ostream& o)
+        : shape(s), out(o), random(s.seed), line(1), count(0), function(-1), callable(0) {}
+
+    void flush() {
+        out.write(buffer.data(), (streamsize)buffer.size());
+        buffer.clear();
+    }
+
+    long long write() {
+        keyword("program");
+        id("bench");
+        sep(";");
+        line++;
+
+        if (shape.constants > 0) {
+            keyword("const");
+            line++;
+            for (int i = 0; i < shape.constants; i++, line++) {
+                id("c" + to_string(i));
+                sep("=");
+                number();
+                sep(";");
+            }
+        }
+
+        // At least one global: assignments need somewhere to go.
+        int globals = shape.globals > 0 ? shape.globals : 1;
+        keyword("var");
+        line++;
+        for (int i = 0; i < globals; i++) {
+            id("g" + to_string(i));
+            if (i % 8 == 7 || i + 1 == globals) {
+                sep(":");
+                keyword("integer");
+                sep(";");
+                line++;
+            }
+            else {
+                sep(",");
+            }
+        }
+
+        for (int i = 0; i < shape.functions; i++) functionDec(i);
+
+        callable = shape.functions;
+        keyword("begin");
+        line++;
+        for (int i = 0; i < shape.statements; i++) statement(0);
+        keyword("end");
+        sep(".");
+        flush();
+        return count;
+    }
+};
+
+}
+
+long long writeProgram(const ProgramShape& shape, ostream& out) {
+    ProgramShape fixed = shape;
+    if (fixed.globals < 1) fixed.globals = 1;
+    ProgramWriter writer(fixed, out);
+    return writer.write();
+}
+
+bool setShapeOption(ProgramShape& shape, const string& name, const string& value) {
+    if (name == "--seed") {
+        shape.seed = stoull(value);
+        return true;
+    }
+    int number = stoi(value);
+    if (number < 0) number = 0;
+    if (name == "--constants") shape.constants = number;
+    else if (name == "--globals") shape.globals = number;
+    else if (name == "--functions") shape.functions = number;
+    else if (name == "--params") shape.params = number;
+    else if (name == "--function-statements") shape.functionStatements = number;
+    else if (name == "--statements") shape.statements = number;
+    else if (name == "--depth") shape.depth = number;
+    else if (name == "--hex") shape.hexPercent = number > 100 ? 100 : number;
+    else return false;
+    return true;
+}
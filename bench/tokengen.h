@@ -0,0 +1,35 @@
+#pragma once
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+// Shape of a generated program. Every name is declared before use, calls
+// only reach functions declared earlier with the right argument count,
+// constants and const parameters are never assigned and var parameters
+// only get variables, so the result always parses and compiles.
+struct ProgramShape {
+    int constants;
+    int globals;
+    int functions;
+    int params;                 // per function, in groups of up to three
+    int functionStatements;     // per function body
+    int statements;             // in the main block
+    int depth;                  // how deep expressions nest
+    int hexPercent;             // share of number literals written as $hex
+    unsigned long long seed;
+
+    ProgramShape()
+        : constants(10), globals(100), functions(100), params(3), functionStatements(10),
+        statements(1000), depth(3), hexPercent(30), seed(1) {}
+};
+
+// Writes the program in lexer.txt format ("line typecode value" per token)
+// and returns the number of tokens. The same shape and seed give the same
+// tokens on every platform.
+long long writeProgram(const ProgramShape& shape, ostream& out);
+
+// Parses "--name value" options into shape; returns false on an unknown
+// name. Names: --constants --globals --functions --params
+// --function-statements --statements --depth --hex --seed.
+bool setShapeOption(ProgramShape& shape, const string& name, const string& value);
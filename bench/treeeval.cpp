@@ -0,0 +1,247 @@
+#include "treeeval.h"
+#include "fold.h"
+#include "vm.h"
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+NodeKind kindOf(const STNode* node) {
+    return (NodeKind)nodeKindOf(node->getData().type);
+}
+
+struct Function {
+    const STNode* params;
+    const STNode* body;
+};
+
+// One call's variables. A var parameter is stored as a pointer to the
+// caller's variable; the maps are node based, so those stay valid when
+// a frame is moved.
+struct Frame {
+    string_view function;
+    unordered_map<string_view, int> values;
+    unordered_map<string_view, int*> refs;
+};
+
+class TreeEvaluator {
+private:
+    ostream& out;
+    unordered_map<string_view, int> globals;
+    unordered_map<string_view, int> constants;
+    unordered_map<string_view, Function> functions;
+    deque<Frame> frames;
+
+    [[noreturn]] void fail(const STNode* node, const string& message) {
+        throw runtime_error("Runtime error at line " + to_string(node->getData().line) + ": " + message);
+    }
+
+    Frame* current() { return frames.empty() ? nullptr : &frames.back(); }
+
+    // The variable a name refers to, or nullptr for a constant or function.
+    int* variable(const STNode* id) {
+        string_view name = id->getData().value;
+        if (Frame* frame = current()) {
+            auto ref = frame->refs.find(name);
+            if (ref != frame->refs.end()) return ref->second;
+            auto value = frame->values.find(name);
+            if (value != frame->values.end()) return &value->second;
+            if (name == frame->function) return &frame->values[name];
+        }
+        auto global = globals.find(name);
+        return global != globals.end() ? &global->second : nullptr;
+    }
+
+    int constant(const STNode* literal) {
+        int value;
+        if (!literalValue(literal->getData(), value)) fail(literal, "number out of range");
+        return value;
+    }
+
+    int evaluateOperand(const STNode* node) {
+        switch (kindOf(node)) {
+        case NODE_DECNUM:
+        case NODE_HEXNUM:
+            return constant(node);
+        case NODE_FUNC_CALL:
+            return call(node->getLeft(), node->getRight());
+        case NODE_ID: {
+            if (int* value = variable(node)) return *value;
+            auto known = constants.find(node->getData().value);
+            if (known != constants.end()) return known->second;
+            return call(node, nullptr);
+        }
+        default:
+            fail(node, "unexpected " + string(node->getData().type));
+        }
+    }
+
+    int evaluate(const STNode* node) {
+        vector<const STNode*> spine;
+        while (kindOf(node) == NODE_BIN_OP) {
+            spine.push_back(node);
+            node = node->getLeft();
+        }
+        int value = evaluateOperand(node);
+        while (!spine.empty()) {
+            const STNode* op = spine.back();
+            spine.pop_back();
+            int right = evaluate(op->getRight());
+            string_view text = op->getData().value;
+            if (text == "+") value = wrapAdd(value, right);
+            else if (text == "-") value = wrapSub(value, right);
+            else if (text == "*") value = wrapMul(value, right);
+            else {
+                if (right == 0) fail(op, "division by zero");
+                value = wrapDiv(value, right);
+            }
+        }
+        return value;
+    }
+
+    int call(const STNode* name, const STNode* args) {
+        auto function = functions.find(name->getData().value);
+        if (function == functions.end()) fail(name, "unknown function '" + string(name->getData().value) + "'");
+
+        // Parameters in order, walked alongside the arguments.
+        vector<const STNode*> params;
+        vector<const STNode*> pending;
+        if (function->second.params) pending.push_back(function->second.params);
+        while (!pending.empty()) {
+            const STNode* node = pending.back();
+            pending.pop_back();
+            if (kindOf(node) == NODE_SEQ) {
+                pending.push_back(node->getRight());
+                pending.push_back(node->getLeft());
+            }
+            else {
+                params.push_back(node);
+            }
+        }
+
+        Frame frame;
+        frame.function = name->getData().value;
+        size_t index = 0;
+        while (args) {
+            const STNode* wrapper = args;
+            if (kindOf(args) == NODE_SEQ) {
+                wrapper = args->getLeft();
+                args = args->getRight();
+            }
+            else {
+                args = nullptr;
+            }
+            const STNode* param = params[index++];
+            if (kindOf(param) == NODE_PARAM_VAR) {
+                frame.refs[param->getLeft()->getData().value] = variable(wrapper->getLeft());
+            }
+            else {
+                frame.values[param->getLeft()->getData().value] = evaluate(wrapper->getLeft());
+            }
+        }
+
+        frames.push_back(move(frame));
+        run(function->second.body);
+        int result = frames.back().values[frames.back().function];
+        frames.pop_back();
+        return result;
+    }
+
+    // Every argument is evaluated before the line is written, as in the VM.
+    void writeln(const STNode* node) {
+        vector<int> values;
+        for (const STNode* arg = node->getRight(); arg; ) {
+            int value;
+            NodeKind kind = kindOf(arg);
+            if (kind == NODE_SEQ) {
+                value = evaluate(arg->getLeft());
+                arg = arg->getRight();
+            }
+            else if (kind == NODE_ID || kind == NODE_DECNUM || kind == NODE_HEXNUM) {
+                value = evaluateOperand(arg);
+                arg = arg->getRight();
+            }
+            else {
+                value = evaluate(arg);
+                arg = nullptr;
+            }
+            values.push_back(value);
+        }
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i) out << ' ';
+            out << values[i];
+        }
+        out << '\n';
+    }
+
+    void declareFunction(const STNode* node) {
+        const STNode* right = node->getRight();
+        Function function{ nullptr, nullptr };
+        if (right && right->getLeft() && kindOf(right->getLeft()) != NODE_TYPE) {
+            function.params = right->getLeft();
+            right = right->getRight();
+        }
+        function.body = right ? right->getRight() : nullptr;
+        functions[node->getLeft()->getData().value] = function;
+    }
+
+public:
+    TreeEvaluator(ostream& o) : out(o) {}
+
+    void run(const STNode* root) {
+        vector<const STNode*> stack;
+        if (root) stack.push_back(root);
+        while (!stack.empty()) {
+            const STNode* node = stack.back();
+            stack.pop_back();
+            switch (kindOf(node)) {
+            case NODE_PROGRAM:
+                if (node->getRight()) stack.push_back(node->getRight());
+                break;
+            case NODE_SEQ:
+                if (node->getRight()) stack.push_back(node->getRight());
+                if (node->getLeft()) stack.push_back(node->getLeft());
+                break;
+            case NODE_COMPOUND_STMT:
+                if (node->getLeft()) stack.push_back(node->getLeft());
+                break;
+            case NODE_VAR_DECL:
+                if (Frame* frame = current()) frame->values[node->getLeft()->getData().value] = 0;
+                else globals[node->getLeft()->getData().value] = 0;
+                break;
+            case NODE_CONST_DECL:
+                constants[node->getLeft()->getData().value] = constant(node->getRight());
+                break;
+            case NODE_FUNCTION:
+                declareFunction(node);
+                break;
+            case NODE_ASSIGN: {
+                int value = evaluate(node->getRight());
+                int* target = variable(node->getLeft());
+                if (!target) fail(node, "cannot assign to '" + string(node->getLeft()->getData().value) + "'");
+                *target = value;
+                break;
+            }
+            case NODE_FUNC_CALL:
+                call(node->getLeft(), node->getRight());
+                break;
+            case NODE_WRITELN:
+                writeln(node);
+                break;
+            default:
+                fail(node, "unexpected " + string(node->getData().type));
+            }
+        }
+    }
+};
+
+}
+
+void evaluateTree(const BinTree& tree, ostream& out) {
+    TreeEvaluator evaluator(out);
+    evaluator.run(tree.getRoot());
+    out.flush();
+}
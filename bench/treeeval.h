@@ -0,0 +1,11 @@
+#pragma once
+#include "stnode.h"
+#include <ostream>
+
+using namespace std;
+
+// Runs a parsed program straight off the tree, the way an interpreter
+// would before it had a compiler: names are looked up by string in hash
+// maps on every use and each call evaluates its function's subtree again.
+// Output and errors match runBytecode's, so the two can be compared.
+void evaluateTree(const BinTree& tree, ostream& out);
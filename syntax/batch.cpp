@@ -0,0 +1,184 @@
+#include "batch.h"
+#include "interner.h"
+#include "parser.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+typedef chrono::steady_clock Clock;
+
+static const char* const TREE_SUFFIX = ".tree";
+
+struct BatchJob {
+    string input;
+    string output;
+    uintmax_t size;
+
+    bool ok;
+    string error;
+    vector<string> diagnostics;     // "line: message", with BatchOptions::allErrors
+    size_t tokens;
+    size_t nodes;
+    double seconds;
+
+    BatchJob(const string& in, const string& out, uintmax_t bytes)
+        : input(in), output(out), size(bytes), ok(false), tokens(0), nodes(0), seconds(0) {}
+};
+
+static bool isTreeFile(const fs::path& path) {
+    return path.extension() == TREE_SUFFIX;
+}
+
+static void addJob(vector<BatchJob>& jobs, const fs::path& input, const fs::path& output) {
+    error_code ec;
+    uintmax_t size = fs::file_size(input, ec);
+    jobs.emplace_back(input.string(), output.string() + TREE_SUFFIX, ec ? 0 : size);
+}
+
+static vector<BatchJob> collectJobs(const vector<string>& paths, const BatchOptions& options) {
+    vector<BatchJob> jobs;
+    fs::path outputDir(options.outputDir);
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        fs::path root(paths[i]);
+        if (!fs::is_directory(root)) {
+            addJob(jobs, root, outputDir.empty() ? root : outputDir / root.filename());
+            continue;
+        }
+
+        vector<fs::path> files;
+        for (fs::recursive_directory_iterator it(root), end; it != end; ++it) {
+            if (it->is_regular_file() && !isTreeFile(it->path())) {
+                files.push_back(it->path());
+            }
+        }
+        sort(files.begin(), files.end());
+
+        for (size_t f = 0; f < files.size(); f++) {
+            addJob(jobs, files[f], outputDir.empty() ? files[f] :
+                outputDir / files[f].lexically_relative(root));
+        }
+    }
+    return jobs;
+}
+
+// Runs on a pool thread; everything it touches besides job and the shared
+// strings is its own.
+static void parseJob(BatchJob& job, bool allErrors, SharedInterner* strings) {
+    Clock::time_point start = Clock::now();
+    try {
+        TokenArray tokens = loadTokens(job.input, false);
+        if (tokens.empty()) {
+            throw runtime_error("No tokens loaded");
+        }
+        job.tokens = tokens.size();
+
+        Parser parser(tokens);
+        parser.setVerbose(false);
+        parser.setInterner(strings);
+        // The diagnostics point into the parser's tree, so they are
+        // formatted before it goes.
+        bool ok = allErrors ? parser.parseWithRecovery() : parser.tryParse();
+        if (!ok) {
+            const vector<ParseDiagnostic>& diagnostics = parser.getDiagnostics();
+            if (allErrors) {
+                for (const ParseDiagnostic& diagnostic : diagnostics) {
+                    job.diagnostics.push_back(to_string(diagnostic.line) + ": " + diagnostic.message());
+                }
+                job.error = to_string(diagnostics.size()) + " error(s)";
+            }
+            else {
+                job.error = "Parsing failed: " + diagnostics.front().message(true);
+            }
+            job.seconds = chrono::duration<double>(Clock::now() - start).count();
+            return;
+        }
+        job.nodes = parser.getST()->getArena().nodesAllocated();
+        parser.getST()->saveToFile(job.output);
+        job.ok = true;
+    }
+    catch (const exception& e) {
+        job.error = e.what();
+    }
+    job.seconds = chrono::duration<double>(Clock::now() - start).count();
+}
+
+int runBatch(const vector<string>& paths, const BatchOptions& options) {
+    Clock::time_point start = Clock::now();
+    vector<BatchJob> jobs = collectJobs(paths, options);
+    if (jobs.empty()) {
+        cerr << "ERROR: No input files" << endl;
+        return 1;
+    }
+
+    // Two inputs must not overwrite each other's tree. Output directories
+    // are created up front so workers never race on them.
+    unordered_map<string, size_t> outputs;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        auto inserted = outputs.emplace(jobs[i].output, i);
+        if (!inserted.second) {
+            jobs[i].error = "Output '" + jobs[i].output + "' is already written for '" +
+                jobs[inserted.first->second].input + "'";
+            jobs[i].output.clear();
+            continue;
+        }
+        fs::path parent = fs::path(jobs[i].output).parent_path();
+        error_code ec;
+        if (!parent.empty()) fs::create_directories(parent, ec);
+    }
+
+    // Each worker runs its newest task first, so submitting the smallest
+    // files first starts every worker on its largest ones and leaves the
+    // small ones for balancing the tail.
+    vector<size_t> order;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (!jobs[i].output.empty()) order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return jobs[a].size < jobs[b].size;
+    });
+
+    // One dictionary for all files: names repeat across a code base, so
+    // each spelling is stored once however many trees use it.
+    SharedInterner strings;
+    WorkStealingPool pool(options.threads);
+    for (size_t i = 0; i < order.size(); i++) {
+        BatchJob* job = &jobs[order[i]];
+        bool allErrors = options.allErrors;
+        pool.submit([job, allErrors, &strings] { parseJob(*job, allErrors, &strings); });
+    }
+    pool.wait();
+    double wallTime = chrono::duration<double>(Clock::now() - start).count();
+
+    size_t failed = 0, tokens = 0, nodes = 0;
+    double busyTime = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchJob& job = jobs[i];
+        busyTime += job.seconds;
+        if (!job.ok) {
+            for (const string& diagnostic : job.diagnostics) {
+                cerr << job.input << ":" << diagnostic << endl;
+            }
+            cerr << job.input << ": Error: " << job.error << endl;
+            failed++;
+            continue;
+        }
+        tokens += job.tokens;
+        nodes += job.nodes;
+    }
+
+    cout << "Batch: " << jobs.size() << " files, " << jobs.size() - failed << " parsed, "
+        << failed << " failed, " << pool.threadCount() << " threads" << endl;
+    cout << "  " << tokens << " tokens, " << nodes << " nodes in " << wallTime * 1000 << " ms ("
+        << jobs.size() / wallTime << " files/s, " << tokens / wallTime / 1e6 << " Mtokens/s)" << endl;
+    cout << "  busy " << busyTime * 1000 << " ms across threads (x"
+        << busyTime / wallTime << " parallel)" << endl;
+    cout << "  " << strings.size() << " distinct strings, " << strings.bytesUsed() << " bytes" << endl;
+
+    return failed ? 1 : 0;
+}
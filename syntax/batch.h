@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BatchOptions {
+    int threads;        // <= 0: one per hardware thread
+    string outputDir;   // empty: write each tree next to its input
+    bool allErrors;     // report every error of a file, not only the first
+
+    BatchOptions() : threads(0), allErrors(false) {}
+};
+
+// Parses every token file named in paths on a WorkStealingPool, each with
+// its own Parser, and saves one tree per input as "<input>.tree".
+// Directories are searched recursively and mirrored under outputDir.
+// Failures are reported per file on cerr, followed by throughput totals on
+// cout. Node text comes from one SharedInterner for the whole run.
+// Returns the process exit code: 0 when every file parsed.
+int runBatch(const vector<string>& paths, const BatchOptions& options);
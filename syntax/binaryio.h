@@ -0,0 +1,59 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Varint helpers shared by the binary token and tree formats.
+
+inline void putVarint(string& out, unsigned int value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+inline unsigned int zigzag(int value) {
+    return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+inline int unzigzag(unsigned int value) {
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+// Bounds-checked cursor over a mapped file; any overrun is reported as a
+// corrupt file of the given kind ("binary token file", ...).
+struct BinaryReader {
+    const unsigned char* pos;
+    const unsigned char* end;
+    const string& filename;
+    const char* what;
+
+    [[noreturn]] void corrupt() const {
+        throw runtime_error(string("Corrupt ") + what + ": " + filename);
+    }
+
+    unsigned char byte() {
+        if (pos >= end) corrupt();
+        return *pos++;
+    }
+
+    unsigned int varint() {
+        unsigned int result = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            unsigned char b = byte();
+            result |= (unsigned int)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return result;
+        }
+        corrupt();
+    }
+
+    string_view bytes(unsigned int count) {
+        if ((size_t)(end - pos) < count) corrupt();
+        string_view result((const char*)pos, count);
+        pos += count;
+        return result;
+    }
+};
@@ -0,0 +1,66 @@
+#include "diagnostic.h"
+#include "token.h"
+
+static string expectedTokenMessage(const ParseDiagnostic& diagnostic, bool withLine) {
+    string error = "Syntax error";
+    if (withLine && !diagnostic.endOfInput && diagnostic.line != -1) {
+        error += " at line " + to_string(diagnostic.line);
+    }
+    error += ": expected ";
+    switch (diagnostic.expectedKind) {
+    case TOKEN_ID: error += "identifier"; break;
+    case TOKEN_HEXNUM: error += "hex number"; break;
+    case TOKEN_DECNUM: error += "decimal number"; break;
+    case TOKEN_SEP: error += "separator"; break;
+    case TOKEN_KEYWORD: error += "keyword"; break;
+    default: error += "token type " + to_string(diagnostic.expectedKind);
+    }
+    if (diagnostic.expectedLexeme != LX_NONE) {
+        error += " '" + string(lexemeText(diagnostic.expectedLexeme)) + "'";
+    }
+    error += ", but found ";
+    if (diagnostic.endOfInput) {
+        error += "end of file";
+    }
+    else {
+        error += tokenTypeName(diagnostic.foundKind);
+        if (!diagnostic.text.empty()) error += " '" + string(diagnostic.text) + "'";
+    }
+    return error;
+}
+
+string ParseDiagnostic::message(bool withLine) const {
+    string name(text);
+    switch (code) {
+    case DIAG_EXPECTED_TOKEN:
+        return expectedTokenMessage(*this, withLine);
+    case DIAG_EXPECTED_BEGIN:
+        return "Syntax error: expected 'begin' after declarations";
+    case DIAG_VAR_IN_MAIN_BLOCK:
+        return "Syntax error: variable declarations must be before 'begin' in main block";
+    case DIAG_VAR_IN_BLOCK:
+        return "Syntax error: variable declarations inside 'begin' block are not allowed";
+    case DIAG_UNTERMINATED_BODY:
+        return "Syntax error: unterminated function body";
+    case DIAG_EXPECTED_ASSIGN_OR_CALL:
+        return "Expected ':=' or '(' after identifier";
+    case DIAG_EXPECTED_FACTOR:
+        return "Expected factor";
+    case DIAG_EXPECTED_NUMBER:
+        return "Expected number";
+    case DIAG_REDECLARED:
+        return "Identifier '" + name + "' already declared";
+    case DIAG_UNDECLARED:
+        return "Undeclared identifier: '" + name + "'";
+    case DIAG_CONST_ASSIGN:
+        return "Cannot assign to constant '" + name + "'";
+    case DIAG_NOT_A_FUNCTION:
+        return "Identifier '" + name + "' is not a function";
+    case DIAG_UNKNOWN_FUNCTION:
+        return "Function '" + name + "' not found in function table";
+    case DIAG_ARGUMENT_COUNT:
+        return "Function '" + name + "' expects " + to_string(expectedCount) + " arguments, but " +
+            to_string(actualCount) + " were provided";
+    }
+    return "Syntax error";
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+enum DiagnosticCode {
+    DIAG_EXPECTED_TOKEN,            // consume() found another token
+    DIAG_EXPECTED_BEGIN,
+    DIAG_VAR_IN_MAIN_BLOCK,
+    DIAG_VAR_IN_BLOCK,
+    DIAG_UNTERMINATED_BODY,
+    DIAG_EXPECTED_ASSIGN_OR_CALL,
+    DIAG_EXPECTED_FACTOR,
+    DIAG_EXPECTED_NUMBER,
+    // These name the identifier in text.
+    DIAG_REDECLARED,
+    DIAG_UNDECLARED,
+    DIAG_CONST_ASSIGN,
+    DIAG_NOT_A_FUNCTION,
+    DIAG_UNKNOWN_FUNCTION,
+    DIAG_ARGUMENT_COUNT
+};
+
+// One parse error as the parser noticed it. Only plain values are stored;
+// the text is built by message(), when someone prints it. text points into
+// the reporting parser's tree, so it lives as long as that tree.
+struct ParseDiagnostic {
+    DiagnosticCode code;
+    int token;                      // index of the token where it was noticed
+    int line;                       // of that token, or -1 at the end of the input
+    bool endOfInput;
+    unsigned char expectedKind;     // DIAG_EXPECTED_TOKEN: what consume() wanted
+    unsigned char expectedLexeme;
+    unsigned char foundKind;        // and what it found; text is its value
+    string_view text;
+    int expectedCount;              // DIAG_ARGUMENT_COUNT
+    int actualCount;
+
+    ParseDiagnostic(DiagnosticCode c, int tokenIndex, int l, string_view t = string_view())
+        : code(c), token(tokenIndex), line(l), endOfInput(false), expectedKind(0), expectedLexeme(0),
+        foundKind(0), text(t), expectedCount(0), actualCount(0) {}
+
+    // The text parse() reports. withLine puts " at line N" into expected-token
+    // errors as parse() always has; lists of diagnostics print line apart.
+    string message(bool withLine = false) const;
+};
@@ -0,0 +1,224 @@
+#include "flattree.h"
+#include <vector>
+
+FlatTree::FlatTree(const BinTree& tree, const TokenArray& tokenArray)
+    : kinds(nullptr), texts(nullptr), lefts(nullptr), rights(nullptr),
+    count(0), capacity(0), rootIndex(-1),
+    literals(nullptr), literalCount(0), literalCapacity(0), tokens(tokenArray) {
+    resize(64);
+    addLiteral("");
+
+    struct Pending {
+        const STNode* node;
+        int parent;
+        bool isRight;
+    };
+    vector<Pending> stack;
+    if (tree.getRoot()) stack.push_back({ tree.getRoot(), -1, false });
+
+    while (!stack.empty()) {
+        Pending item = stack.back();
+        stack.pop_back();
+
+        int index = addNode(item.node->getData());
+        if (item.parent < 0) {
+            rootIndex = index;
+        }
+        else if (item.isRight) {
+            rights[item.parent] = index;
+        }
+        else {
+            lefts[item.parent] = index;
+        }
+
+        if (item.node->getRight()) stack.push_back({ item.node->getRight(), index, true });
+        if (item.node->getLeft()) stack.push_back({ item.node->getLeft(), index, false });
+    }
+}
+
+FlatTree::~FlatTree() {
+    delete[] kinds;
+    delete[] texts;
+    delete[] lefts;
+    delete[] rights;
+    delete[] literals;
+}
+
+void FlatTree::resize(int newCapacity) {
+    unsigned char* newKinds = new unsigned char[newCapacity];
+    int* newTexts = new int[newCapacity];
+    int* newLefts = new int[newCapacity];
+    int* newRights = new int[newCapacity];
+
+    for (int i = 0; i < count; i++) {
+        newKinds[i] = kinds[i];
+        newTexts[i] = texts[i];
+        newLefts[i] = lefts[i];
+        newRights[i] = rights[i];
+    }
+
+    delete[] kinds;
+    delete[] texts;
+    delete[] lefts;
+    delete[] rights;
+    kinds = newKinds;
+    texts = newTexts;
+    lefts = newLefts;
+    rights = newRights;
+    capacity = newCapacity;
+}
+
+int FlatTree::addLiteral(string_view text) {
+    // Only synthesized values end up here (TYPE spellings and the like), so
+    // the pool stays tiny and a linear scan is enough.
+    for (int i = 0; i < literalCount; i++) {
+        if (literals[i] == text) return i;
+    }
+    if (literalCount >= literalCapacity) {
+        int newCap = literalCapacity ? literalCapacity * 2 : 4;
+        string* newLiterals = new string[newCap];
+        for (int i = 0; i < literalCount; i++) {
+            newLiterals[i] = literals[i];
+        }
+        delete[] literals;
+        literals = newLiterals;
+        literalCapacity = newCap;
+    }
+    literals[literalCount] = string(text);
+    return literalCount++;
+}
+
+int FlatTree::addNode(const STData& data) {
+    if (count >= capacity) {
+        resize(capacity * 2);
+    }
+    kinds[count] = (unsigned char)nodeKindOf(data.type);
+    texts[count] = data.token >= 0 ? data.token : ~addLiteral(data.value);
+    lefts[count] = -1;
+    rights[count] = -1;
+    return count++;
+}
+
+int FlatTree::countParams(int node) const {
+    if (node < 0) return 0;
+
+    int result = 0;
+    vector<int> stack;
+    stack.push_back(node);
+
+    while (!stack.empty()) {
+        int current = stack.back();
+        stack.pop_back();
+
+        NodeKind k = kind(current);
+        if (k == NODE_PARAM_VAL || k == NODE_PARAM_VAR || k == NODE_PARAM_CONST) {
+            result++;
+        }
+        else if (k == NODE_SEQ) {
+            if (rights[current] >= 0) stack.push_back(rights[current]);
+            if (lefts[current] >= 0) stack.push_back(lefts[current]);
+        }
+    }
+
+    return result;
+}
+
+int FlatTree::countArguments(int node) const {
+    if (node < 0) return 0;
+
+    int result = 0;
+    vector<int> stack;
+    stack.push_back(node);
+
+    while (!stack.empty()) {
+        int current = stack.back();
+        stack.pop_back();
+
+        if (kind(current) != NODE_SEQ) {
+            result++;
+        }
+        else {
+            if (rights[current] >= 0) stack.push_back(rights[current]);
+            if (lefts[current] >= 0) stack.push_back(lefts[current]);
+        }
+    }
+
+    return result;
+}
+
+void FlatTree::printST() const {
+    printST(cout);
+}
+
+void FlatTree::printST(ostream& out) const {
+    TextWriter writer(out);
+    printST(writer);
+}
+
+void FlatTree::printST(TextWriter& out) const {
+    if (rootIndex < 0) {
+        out.put("(empty tree)\n");
+        return;
+    }
+
+    struct Pending {
+        int node;
+        int depth;
+    };
+    vector<Pending> stack;
+    stack.push_back({ rootIndex, 0 });
+
+    while (!stack.empty()) {
+        Pending item = stack.back();
+        stack.pop_back();
+
+        out.indent(item.depth * 2);
+        out.label(nodeKindName(kind(item.node)), text(item.node));
+        out.put('\n');
+
+        if (rights[item.node] >= 0) stack.push_back({ rights[item.node], item.depth + 1 });
+        if (lefts[item.node] >= 0) stack.push_back({ lefts[item.node], item.depth + 1 });
+    }
+}
+
+void FlatTree::write(ostream& out) const {
+    TextWriter writer(out);
+    write(writer);
+}
+
+void FlatTree::write(TextWriter& out) const {
+    if (rootIndex < 0) {
+        out.put("(empty)\n");
+        return;
+    }
+
+    // ~node on the stack stands for the ")" that closes node.
+    vector<int> stack;
+    stack.push_back(rootIndex);
+
+    while (!stack.empty()) {
+        int item = stack.back();
+        stack.pop_back();
+
+        if (item < 0) {
+            out.put(')');
+            continue;
+        }
+
+        out.put('(');
+        out.label(nodeKindName(kind(item)), text(item));
+        stack.push_back(~item);
+        if (rights[item] >= 0) stack.push_back(rights[item]);
+        if (lefts[item] >= 0) stack.push_back(lefts[item]);
+    }
+    out.put('\n');
+}
+
+void FlatTree::saveToFile(const string& filename) const {
+    ofstream file(filename);
+    if (!file.is_open()) {
+        throw runtime_error("Cannot open file: " + filename);
+    }
+    write(file);
+    file.close();
+}
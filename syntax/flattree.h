@@ -0,0 +1,64 @@
+#pragma once
+#include "stnode.h"
+#include "token.h"
+#include <iostream>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Read-only copy of a BinTree laid out as parallel arrays in preorder, so a
+// node's left child is usually the next slot. Node text is not copied: a
+// node names the token it came from, or one of a few synthesized spellings
+// ("integer", "INTEGER", ...). The TokenArray must outlive the FlatTree.
+class FlatTree {
+private:
+    unsigned char* kinds;
+    int* texts;     // >= 0: token index, < 0: ~index into literals
+    int* lefts;     // -1 when absent
+    int* rights;
+    int count;
+    int capacity;
+    int rootIndex;
+
+    string* literals;
+    int literalCount;
+    int literalCapacity;
+
+    const TokenArray& tokens;
+
+    void resize(int newCapacity);
+    int addNode(const STData& data);
+    int addLiteral(string_view text);
+
+public:
+    FlatTree(const BinTree& tree, const TokenArray& tokens);
+    ~FlatTree();
+
+    FlatTree(const FlatTree&) = delete;
+    FlatTree& operator=(const FlatTree&) = delete;
+
+    int size() const { return count; }
+    int root() const { return rootIndex; }
+    bool isEmpty() const { return rootIndex < 0; }
+
+    NodeKind kind(int node) const { return (NodeKind)kinds[node]; }
+    int left(int node) const { return lefts[node]; }
+    int right(int node) const { return rights[node]; }
+    string_view text(int node) const {
+        int t = texts[node];
+        return t >= 0 ? tokens[t].value : string_view(literals[~t]);
+    }
+
+    // Parser::countParams and countArguments on the flat layout, for
+    // walks over a finished tree.
+    int countParams(int node) const;
+    int countArguments(int node) const;
+
+    void printST() const;
+    void printST(ostream& out) const;
+    void printST(TextWriter& out) const;
+    void write(ostream& out) const;
+    void write(TextWriter& out) const;
+    void saveToFile(const string& filename) const;
+};
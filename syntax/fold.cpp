@@ -0,0 +1,307 @@
+#include "fold.h"
+#include <climits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+bool literalValue(const STData& data, int& value) {
+    string_view text = data.value;
+    size_t i = 0;
+    int base = 10;
+    bool negative = false;
+    if (data.type == "HEXNUM") {
+        if (text.empty() || text[0] != '$') return false;
+        base = 16;
+        i = 1;
+    }
+    else if (data.type == "DECNUM") {
+        if (!text.empty() && text[0] == '-') {
+            negative = true;
+            i = 1;
+        }
+    }
+    else {
+        return false;
+    }
+    if (i == text.size()) return false;
+
+    long long result = 0;
+    for (; i < text.size(); i++) {
+        char c = text[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (base == 16 && c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else if (base == 16 && c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else return false;
+        result = result * base + digit;
+        if (result > (long long)INT_MAX + 1) return false;
+    }
+    if (negative) result = -result;
+    if (result > INT_MAX) return false;
+    value = (int)result;
+    return true;
+}
+
+namespace {
+
+// A name in scope: a const, with its value node, or anything else that
+// hides an outer const of the same name.
+struct Binding {
+    bool constant;
+    bool known;             // the value fits in 32 bits
+    int value;
+    const STNode* literal;
+};
+
+struct Known {
+    bool known;
+    int value;
+
+    Known() : known(false), value(0) {}
+    Known(int v) : known(true), value(v) {}
+};
+
+NodeKind kindOf(const STNode* node) {
+    return (NodeKind)nodeKindOf(node->getData().type);
+}
+
+// Result of left op right, false on division by zero or overflow.
+bool evaluate(string_view op, int left, int right, int& result) {
+    long long value;
+    if (op == "+") value = (long long)left + right;
+    else if (op == "-") value = (long long)left - right;
+    else if (op == "*") value = (long long)left * right;
+    else if (op == "/" || op == "div") {
+        if (right == 0) return false;
+        value = (long long)left / right;
+    }
+    else return false;
+    if (value < INT_MIN || value > INT_MAX) return false;
+    result = (int)value;
+    return true;
+}
+
+class ConstantFolder {
+private:
+    BinTree& tree;
+    FoldStats stats;
+    unordered_map<string_view, Binding> globals;
+    unordered_map<string_view, Binding> locals;
+    bool inFunction;
+    // Left spines of operator chains, shared by nested folds. The parser
+    // builds a + b + c ... in a loop, so these get as long as the input.
+    vector<STNode*> spine;
+
+    const Binding* lookup(string_view name) const {
+        if (inFunction) {
+            auto local = locals.find(name);
+            if (local != locals.end()) return &local->second;
+        }
+        auto global = globals.find(name);
+        return global != globals.end() ? &global->second : nullptr;
+    }
+
+    void declare(const STNode* id, const Binding& binding) {
+        if (!id) return;
+        (inFunction ? locals : globals)[id->getData().value] = binding;
+    }
+
+    void declareConst(const STNode* decl) {
+        const STNode* literal = decl->getRight();
+        if (!literal) return;
+        Binding binding{ true, false, 0, literal };
+        binding.known = literalValue(literal->getData(), binding.value);
+        if (binding.known) stats.literals++;
+        declare(decl->getLeft(), binding);
+    }
+
+    // The const's literal in place of id, keeping id's links.
+    STNode* substitute(const STNode* id, const Binding& binding) {
+        const STData& literal = binding.literal->getData();
+        STNode* node = tree.newNode(STData(literal.type, literal.value, id->getData().line, literal.token));
+        node->setLeft(id->getLeft());
+        node->setRight(id->getRight());
+        stats.substituted++;
+        return node;
+    }
+
+    STNode* foldLeaf(STNode* node, Known& result) {
+        result = Known();
+        if (!node) return node;
+        switch (kindOf(node)) {
+        case NODE_DECNUM:
+        case NODE_HEXNUM: {
+            int value;
+            if (literalValue(node->getData(), value)) {
+                stats.literals++;
+                result = Known(value);
+            }
+            return node;
+        }
+        case NODE_ID: {
+            const Binding* binding = lookup(node->getData().value);
+            if (!binding || !binding->constant) return node;
+            if (binding->known) result = Known(binding->value);
+            return substitute(node, *binding);
+        }
+        case NODE_FUNC_CALL:
+            foldArguments(node->getRight());
+            return node;
+        default:
+            return node;
+        }
+    }
+
+    STNode* combine(STNode* op, Known& left, const Known& right) {
+        if (!left.known || !right.known) {
+            left = Known();
+            return op;
+        }
+        int value;
+        if (!evaluate(op->getData().value, left.value, right.value, value)) {
+            stats.kept++;
+            left = Known();
+            return op;
+        }
+        stats.folded++;
+        stats.removed += 2;
+        left = Known(value);
+        return tree.newNode(STData("DECNUM", tree.storeText(to_string(value)), op->getData().line));
+    }
+
+    // Returns what takes node's place, with its value in result when known.
+    STNode* foldExpression(STNode* node, Known& result) {
+        size_t base = spine.size();
+        while (node && kindOf(node) == NODE_BIN_OP) {
+            spine.push_back(node);
+            node = node->getLeft();
+        }
+        node = foldLeaf(node, result);
+
+        while (spine.size() > base) {
+            STNode* op = spine.back();
+            spine.pop_back();
+            op->setLeft(node);
+            Known right;
+            op->setRight(foldExpression(op->getRight(), right));
+            node = combine(op, result, right);
+        }
+        return node;
+    }
+
+    // A SEQ chain of PARAM_VAL wrappers, each with its argument on the left.
+    void foldArguments(STNode* args) {
+        while (args) {
+            STNode* wrapper = args;
+            if (kindOf(args) == NODE_SEQ) {
+                wrapper = args->getLeft();
+                args = args->getRight();
+            }
+            else {
+                args = nullptr;
+            }
+            if (!wrapper) continue;
+            Known ignored;
+            wrapper->setLeft(foldExpression(wrapper->getLeft(), ignored));
+        }
+    }
+
+    // The arguments chain through right links: an ID or number's own, or
+    // a SEQ's holding the argument on its left. Anything else is the last
+    // argument, whole.
+    void foldWriteln(STNode* writeln) {
+        STNode* parent = writeln;
+        STNode* node = writeln->getRight();
+        while (node) {
+            Known ignored;
+            NodeKind kind = kindOf(node);
+            if (kind == NODE_ID) {
+                const Binding* binding = lookup(node->getData().value);
+                if (binding && binding->constant) {
+                    node = substitute(node, *binding);
+                    parent->setRight(node);
+                }
+            }
+            else if (kind == NODE_SEQ) {
+                node->setLeft(foldExpression(node->getLeft(), ignored));
+            }
+            else if (kind != NODE_DECNUM && kind != NODE_HEXNUM) {
+                parent->setRight(foldExpression(node, ignored));
+                return;
+            }
+            parent = node;
+            node = node->getRight();
+        }
+    }
+
+public:
+    ConstantFolder(BinTree& t) : tree(t), inFunction(false) {}
+
+    FoldStats run() {
+        // Preorder, so declarations are seen before the code after them.
+        // An entry with leaving set follows each FUNCTION's subtree and
+        // closes its scope.
+        vector<pair<STNode*, bool>> stack;
+        stack.push_back({ tree.getRoot(), false });
+        while (!stack.empty()) {
+            STNode* node = stack.back().first;
+            bool leaving = stack.back().second;
+            stack.pop_back();
+            if (leaving) {
+                inFunction = false;
+                locals.clear();
+                continue;
+            }
+            if (!node) continue;
+            switch (kindOf(node)) {
+            case NODE_PROGRAM:
+                stack.push_back({ node->getRight(), false });
+                break;
+            case NODE_COMPOUND_STMT:
+                stack.push_back({ node->getLeft(), false });
+                break;
+            case NODE_SEQ:
+                stack.push_back({ node->getRight(), false });
+                stack.push_back({ node->getLeft(), false });
+                break;
+            case NODE_FUNCTION:
+                inFunction = true;
+                stack.push_back({ node, true });
+                stack.push_back({ node->getRight(), false });
+                break;
+            case NODE_CONST_DECL:
+                declareConst(node);
+                break;
+            case NODE_VAR_DECL:
+            case NODE_PARAM_VAL:
+            case NODE_PARAM_VAR:
+            case NODE_PARAM_CONST:
+                declare(node->getLeft(), Binding{ false, false, 0, nullptr });
+                break;
+            case NODE_ASSIGN: {
+                Known ignored;
+                node->setRight(foldExpression(node->getRight(), ignored));
+                break;
+            }
+            case NODE_FUNC_CALL:
+                foldArguments(node->getRight());
+                break;
+            case NODE_WRITELN:
+                foldWriteln(node);
+                break;
+            default:
+                break;
+            }
+        }
+        return stats;
+    }
+};
+
+}
+
+FoldStats foldConstants(BinTree& tree) {
+    if (tree.isShared()) throw runtime_error("Cannot fold a hash-consed tree: its nodes are shared");
+    ConstantFolder folder(tree);
+    return folder.run();
+}
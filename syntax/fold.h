@@ -0,0 +1,31 @@
+#pragma once
+#include "stnode.h"
+#include <string_view>
+
+using namespace std;
+
+// What foldConstants changed. Every fold turns an operator and its two
+// literal operands into one literal, so removed is twice folded.
+struct FoldStats {
+    int literals;       // number literals decoded
+    int substituted;    // uses of a const replaced by its value
+    int folded;         // BIN_OP nodes replaced by their result
+    int kept;           // constant operations left alone: division by zero or overflow
+    int removed;        // nodes no longer reachable from the root
+
+    FoldStats() : literals(0), substituted(0), folded(0), kept(0), removed(0) {}
+};
+
+// Value of a DECNUM ("42", or "-42" as folding writes them) or HEXNUM
+// ("$2A") node as a 32-bit integer; false when it does not fit.
+bool literalValue(const STData& data, int& value);
+
+// Replaces every use of a const with its value and every + - * / div
+// whose operands are both known with its result, scope by scope: a
+// parameter or local variable hides a global const of the same name.
+// The language has only integers, so / truncates like div. Results are
+// 32-bit; an operation that would overflow or divide by zero is kept for
+// run time. Declarations stay, the tree stays printable, and nodes that
+// fall out of it are left in the arena. Throws runtime_error for a tree
+// hashConsTree has shared.
+FoldStats foldConstants(BinTree& tree);
@@ -0,0 +1,127 @@
+#include "hashcons.h"
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// A node's identity once its children are canonical: value views point
+// at the one stored copy of their text, so they compare by address.
+struct NodeKey {
+    string_view type;
+    const char* value;
+    size_t length;
+    const STNode* left;
+    const STNode* right;
+
+    bool operator==(const NodeKey& other) const {
+        return value == other.value && length == other.length && left == other.left &&
+            right == other.right && type == other.type;
+    }
+};
+
+struct NodeKeyHash {
+    size_t operator()(const NodeKey& key) const {
+        size_t h = hash<string_view>()(key.type);
+        h = h * 31 + hash<const void*>()(key.value);
+        h = h * 31 + key.length;
+        h = h * 31 + hash<const void*>()(key.left);
+        h = h * 31 + hash<const void*>()(key.right);
+        return h;
+    }
+};
+
+class HashConser {
+private:
+    NodeArena fresh;
+    unordered_map<string_view, string_view> texts;
+    unordered_map<NodeKey, STNode*, NodeKeyHash> nodes;
+    // Original node to its canonical copy and the size of its subtree
+    // written out in full. Keyed by the original, so subtrees the parser
+    // already shared are only visited once.
+    unordered_map<const STNode*, pair<STNode*, size_t>> done;
+
+    string_view intern(string_view text) {
+        if (text.empty()) return string_view();
+        auto found = texts.find(text);
+        if (found != texts.end()) return found->second;
+        string_view stored = fresh.storeText(text);
+        texts.emplace(stored, stored);
+        return stored;
+    }
+
+    // Children are done by the time their parent is.
+    void finish(const STNode* node) {
+        const STData& data = node->getData();
+        const pair<STNode*, size_t>* left = node->getLeft() ? &done[node->getLeft()] : nullptr;
+        const pair<STNode*, size_t>* right = node->getRight() ? &done[node->getRight()] : nullptr;
+
+        string_view value = intern(data.value);
+        NodeKey key{ data.type, value.data(), value.size(), left ? left->first : nullptr, right ? right->first : nullptr };
+        STNode*& canonical = nodes[key];
+        if (!canonical) {
+            canonical = fresh.newNode(STData(data.type, value, data.line, data.token));
+            canonical->setLeft(left ? left->first : nullptr);
+            canonical->setRight(right ? right->first : nullptr);
+        }
+        size_t size = 1 + (left ? left->second : 0) + (right ? right->second : 0);
+        done[node] = { canonical, size };
+    }
+
+public:
+    HashConsStats run(BinTree& tree) {
+        HashConsStats stats;
+        stats.nodesBefore = tree.getArena().nodesAllocated();
+        stats.bytesBefore = tree.getArena().bytesUsed();
+        done.reserve(stats.nodesBefore);
+        nodes.reserve(stats.nodesBefore);
+
+        // Postorder with left subtrees first, so the first of several
+        // equal subtrees in preorder is the one kept.
+        vector<pair<const STNode*, bool>> stack;
+        if (tree.getRoot()) stack.push_back({ tree.getRoot(), false });
+        while (!stack.empty()) {
+            pair<const STNode*, bool>& top = stack.back();
+            const STNode* node = top.first;
+            if (done.count(node)) {
+                stack.pop_back();
+                continue;
+            }
+            if (top.second) {
+                stack.pop_back();
+                finish(node);
+                continue;
+            }
+            top.second = true;
+            if (node->getRight()) stack.push_back({ node->getRight(), false });
+            if (node->getLeft()) stack.push_back({ node->getLeft(), false });
+        }
+
+        STNode* root = nullptr;
+        if (tree.getRoot()) {
+            root = done[tree.getRoot()].first;
+            stats.occurrences = done[tree.getRoot()].second;
+        }
+        // done is keyed by nodes of the old arena; drop it before the arena.
+        done.clear();
+        nodes.clear();
+        texts.clear();
+
+        tree.getArena().clear();
+        tree.getArena().adopt(fresh);
+        tree.setRoot(root);
+        tree.markShared();
+
+        stats.nodesAfter = tree.getArena().nodesAllocated();
+        stats.bytesAfter = tree.getArena().bytesUsed();
+        return stats;
+    }
+};
+
+}
+
+HashConsStats hashConsTree(BinTree& tree) {
+    HashConser conser;
+    return conser.run(tree);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "stnode.h"
+#include <cstddef>
+
+using namespace std;
+
+struct HashConsStats {
+    size_t nodesBefore;     // allocated in the arena, dropped ones included
+    size_t nodesAfter;
+    size_t bytesBefore;     // arena bytes, node text included
+    size_t bytesAfter;
+    size_t occurrences;     // nodes in the tree written out in full
+
+    HashConsStats() : nodesBefore(0), nodesAfter(0), bytesBefore(0), bytesAfter(0), occurrences(0) {}
+};
+
+// Stores every distinct subtree of tree once: two nodes with the same
+// type, value and children become one node with several parents, so
+// repeated TYPE nodes, argument wrappers and references to the same name
+// collapse, along with any larger subtrees built from them. Node text is
+// stored once per distinct string.
+//
+// The tree is rebuilt into a fresh arena and the old one is dropped, so
+// STNode pointers and text views taken before the call are invalid. A
+// shared node keeps the line and token of the first occurrence in
+// preorder: printST, write and saveToFile print exactly what they did
+// before, while saveTreeBinary writes that one position for every
+// occurrence. The tree is marked shared and must not be modified
+// afterwards; foldConstants refuses it.
+HashConsStats hashConsTree(BinTree& tree);
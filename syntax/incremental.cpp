@@ -0,0 +1,237 @@
+#include "incremental.h"
+
+// Dropped subtrees stay in the arena until the next full parse.
+static const size_t SLACK_NODES = 4096;
+
+IncrementalParser::IncrementalParser(const TokenArray& tokens, int threadCount)
+    : threads(threadCount), shiftFrom(0), shiftTokens(0), shiftLines(0), unsettled(false),
+    tokenCount(0), lastLine(-1), broken(-1), liveNodes(0) {
+    parseAll(tokens);
+}
+
+void IncrementalParser::parseAll(const TokenArray& tokens) {
+    parser.reset();
+    pieces.clear();
+    shiftFrom = 0;
+    shiftTokens = 0;
+    shiftLines = 0;
+    unsettled = false;
+    broken = -1;
+    tokenCount = tokens.size();
+    lastLine = tokens.empty() ? -1 : tokens[tokens.size() - 1].line;
+
+    unique_ptr<Parser> full(new Parser(tokens));
+    full->setVerbose(false);
+    full->parseParallel(threads);
+    parser = move(full);
+    liveNodes = parser->stTree->getArena().nodesAllocated();
+
+    // Without phase one's ranges every edit parses everything again.
+    if (!parser->splitParse) return;
+
+    // PROGRAM's right child is SEQ(declarations, main block), or whichever
+    // of the two exists. Both are right-leaning SEQ chains whose items are
+    // never SEQs themselves: each item is the left child of a SEQ, the last
+    // one the right child of the last SEQ.
+    STNode* root = parser->stTree->getRoot();
+    STNode* blockParent = parser->mainBlockParent;
+    STNode* node = blockParent ? (blockParent == root ? nullptr : blockParent->getLeft()) : root->getRight();
+
+    size_t function = 0;
+    int previousEnd = 0;
+    auto addDeclaration = [&](STNode* item) {
+        if (item->getData().type != "FUNCTION") {
+            pieces.push_back(Piece{ PIECE_DECLARATION, previousEnd, previousEnd, previousEnd, item, false, 0, 0, 0 });
+            return true;
+        }
+        if (function >= parser->deferred.size() || parser->deferred[function].funcNode != item) return false;
+        const Parser::DeferredBody& body = parser->deferred[function++];
+        pieces.push_back(Piece{ PIECE_FUNCTION, body.start, body.bodyStart, body.end, item, false,
+            body.visibleGlobals, 0, 0 });
+        previousEnd = body.end;
+        return true;
+    };
+    bool known = true;
+    for (; node && node->getData().type == "SEQ"; node = node->getRight()) {
+        known = known && addDeclaration(node->getLeft());
+    }
+    if (node) known = known && addDeclaration(node);
+
+    int allGlobals = parser->symbols.bindingMark();
+    STNode* holder = blockParent;
+    node = holder ? holder->getRight() : nullptr;
+    for (const Parser::StatementRange& range : parser->mainStatements) {
+        if (!node) break;
+        if (node->getData().type == "SEQ") {
+            pieces.push_back(Piece{ PIECE_STATEMENT, range.start, range.start, range.end, node, false, allGlobals, 0, 0 });
+            holder = node;
+            node = node->getRight();
+        }
+        else {
+            pieces.push_back(Piece{ PIECE_STATEMENT, range.start, range.start, range.end, holder, true, allGlobals, 0, 0 });
+            node = nullptr;
+        }
+    }
+
+    if (!known || function != parser->deferred.size() || node) pieces.clear();
+    shiftFrom = pieces.size();
+}
+
+// The piece that edit lies inside, or -1. Function headers are not part
+// of their piece: they change the globals.
+int IncrementalParser::findPiece(const TokenEdit& edit) const {
+    int low = 0;
+    int high = (int)pieces.size();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        int start = pieces[mid].start + ((size_t)mid >= shiftFrom ? shiftTokens : 0);
+        if (start <= edit.start) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0) return -1;
+
+    const Piece& piece = pieces[low - 1];
+    int shift = (size_t)(low - 1) >= shiftFrom ? shiftTokens : 0;
+    int editEnd = edit.start + edit.removed;
+    if (piece.kind == PIECE_DECLARATION) return -1;
+    if (edit.start < piece.bodyStart + shift || editEnd > piece.end + shift) return -1;
+    // A pure insertion at either edge could as well belong to a neighbour.
+    if (edit.removed == 0 && (edit.start == piece.start + shift || edit.start == piece.end + shift)) return -1;
+    return low - 1;
+}
+
+void IncrementalParser::shiftPieces(size_t from, size_t to, int tokens, int lines) {
+    if (tokens == 0 && lines == 0) return;
+    for (size_t i = from; i < to; i++) {
+        pieces[i].start += tokens;
+        pieces[i].bodyStart += tokens;
+        pieces[i].end += tokens;
+        pieces[i].moved += tokens;
+        pieces[i].movedLines += lines;
+    }
+}
+
+void IncrementalParser::settle() {
+    if (!unsettled) return;
+
+    shiftPieces(shiftFrom, pieces.size(), shiftTokens, shiftLines);
+    shiftFrom = pieces.size();
+    shiftTokens = 0;
+    shiftLines = 0;
+
+    NodeStack stack;
+    // The parameters of a group share one TYPE node, met once per parameter
+    // and one after the other.
+    const STNode* lastType = nullptr;
+    for (Piece& piece : pieces) {
+        if (piece.moved == 0 && piece.movedLines == 0) continue;
+        if (piece.root()) stack.push(piece.root());
+        while (!stack.isEmpty()) {
+            STNode* node = stack.pop();
+            const STData& data = node->getData();
+            if (data.type == "TYPE") {
+                if (node == lastType) continue;
+                lastType = node;
+            }
+            node->moveToToken(data.token >= 0 ? data.token + piece.moved : data.token,
+                data.line >= 0 ? data.line + piece.movedLines : data.line);
+            if (node->getRight()) stack.push(node->getRight());
+            if (node->getLeft()) stack.push(node->getLeft());
+        }
+        piece.moved = 0;
+        piece.movedLines = 0;
+    }
+    unsettled = false;
+}
+
+bool IncrementalParser::update(const TokenArray& tokens, const TokenEdit& edit) {
+    int delta = edit.inserted - edit.removed;
+    bool usable = parser && edit.start >= 0 && edit.removed >= 0 && edit.inserted >= 0 &&
+        edit.start + edit.removed <= tokenCount && tokens.size() == tokenCount + delta &&
+        parser->stTree->getArena().nodesAllocated() <= 2 * liveNodes + SLACK_NODES &&
+        !parser->stTree->isShared();
+
+    int index = usable ? findPiece(edit) : -1;
+    if (index < 0 || (broken >= 0 && index != broken)) {
+        parseAll(tokens);
+        return false;
+    }
+
+    if ((size_t)index >= shiftFrom) {
+        shiftPieces(shiftFrom, index + 1, shiftTokens, shiftLines);
+        shiftFrom = index + 1;
+    }
+
+    Piece& piece = pieces[index];
+    Parser part(tokens, piece.start, parser->symbols, piece.visibleGlobals, piece.kind == PIECE_FUNCTION);
+    // New nodes go straight into the kept tree.
+    delete part.stTree;
+    part.stTree = parser->stTree;
+
+    STNode* node = nullptr;
+    if (piece.kind == PIECE_FUNCTION) {
+        node = part.FunctionDec();
+    }
+    else {
+        node = part.Stmnt();
+        if (node && part.match(SEP, SEP_SEMICOLON)) part.advance();
+    }
+    part.stTree = nullptr;
+
+    if (!part.failed && (!node || part.tokens.position() != piece.end + delta)) {
+        // The edit moved where this piece ends.
+        parseAll(tokens);
+        return false;
+    }
+
+    // The old subtree is dropped either way.
+    if (piece.kind == PIECE_FUNCTION) {
+        piece.node->setLeft(nullptr);
+        piece.node->setRight(nullptr);
+    }
+    else if (piece.inRight) {
+        piece.node->setRight(nullptr);
+    }
+    else {
+        piece.node->setLeft(nullptr);
+    }
+    piece.end += delta;
+    piece.moved = 0;
+    piece.movedLines = 0;
+
+    // Tokens after the edit all move by delta and by the same number of lines.
+    int lineDelta = tokens.empty() ? 0 : tokens[tokens.size() - 1].line - lastLine;
+    shiftPieces(index + 1, shiftFrom, delta, lineDelta);
+    shiftTokens += delta;
+    shiftLines += lineDelta;
+    if (delta != 0 || lineDelta != 0) unsettled = true;
+    tokenCount = tokens.size();
+    lastLine += lineDelta;
+
+    if (part.failed) {
+        // Everything before this piece is unchanged and parsed, so a full
+        // parse stops at this same error. Its text lives in the kept tree.
+        broken = index;
+        throw runtime_error("Parsing failed: " + part.diagnostics.front().message(true));
+    }
+
+    if (piece.kind == PIECE_FUNCTION) {
+        piece.node->setLeft(node->getLeft());
+        piece.node->setRight(node->getRight());
+        piece.node->moveToToken(-1, node->getData().line);
+    }
+    else if (piece.inRight) {
+        piece.node->setRight(node);
+    }
+    else {
+        piece.node->setLeft(node);
+    }
+    broken = -1;
+    return true;
+}
+
+BinTree* IncrementalParser::getST() {
+    if (!parser || broken >= 0) return nullptr;
+    settle();
+    return parser->stTree;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "parser.h"
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Tokens [start, start + removed) of the previous array replaced by
+// inserted new ones.
+struct TokenEdit {
+    int start;
+    int removed;
+    int inserted;
+
+    TokenEdit(int s = 0, int r = 0, int i = 0) : start(s), removed(r), inserted(i) {}
+};
+
+// Keeps the tree of a token file up to date while the file is edited.
+//
+// The first parse is a Parser::parseParallel split, which leaves the
+// globals, every function's token range and every top-level statement of
+// the main block on record. An edit that stays inside one function body or
+// one such statement reparses only that piece against the frozen globals
+// and splices it into the tree; every other subtree is kept as it is.
+// Edits to declarations, function headers, or across pieces parse the
+// whole file again, as does a tree that has piled up as many dropped nodes
+// as live ones or one that hashConsTree has shared.
+//
+// Kept subtrees after an edit still name their tokens by the old indices
+// and lines; getST() moves them all in one walk, however many edits came
+// in between, so update() itself does not depend on the size of the file.
+//
+// Trees and errors are the same as Parser::parse() on the edited tokens,
+// except that the SEQ nodes linking top-level items keep the line they
+// were first made on.
+class IncrementalParser {
+private:
+    enum PieceKind {
+        PIECE_FUNCTION,
+        PIECE_STATEMENT,
+        PIECE_DECLARATION   // a global const or var: only ever moved
+    };
+
+    struct Piece {
+        PieceKind kind;
+        int start;          // declarations: the end of the piece before
+        int bodyStart;      // functions: first token after the header
+        int end;
+        STNode* node;       // the FUNCTION or declaration node, or the node holding the statement
+        bool inRight;       // statements: held as node's right child
+        int visibleGlobals;
+        int moved;          // tokens and lines the subtree still has to move by
+        int movedLines;
+
+        STNode* root() const {
+            if (kind != PIECE_STATEMENT) return node;
+            return inRight ? node->getRight() : node->getLeft();
+        }
+    };
+
+    int threads;
+    unique_ptr<Parser> parser;  // phase one of the last full parse, with the tree
+    vector<Piece> pieces;       // in token order
+    // Pieces from shiftFrom on have yet to add shiftTokens to their range
+    // and moved, and shiftLines to movedLines. Edits close together then
+    // only touch the pieces between them.
+    size_t shiftFrom;
+    int shiftTokens;
+    int shiftLines;
+    bool unsettled;             // some piece has moved != 0
+    int tokenCount;
+    int lastLine;               // line of the last token
+    int broken;                 // piece whose last reparse failed, -1 if none
+    size_t liveNodes;           // nodes in the tree after the last full parse
+
+    void parseAll(const TokenArray& tokens);
+    int findPiece(const TokenEdit& edit) const;
+    void shiftPieces(size_t from, size_t to, int tokens, int lines);
+    void settle();
+
+public:
+    // Parses tokens in full; throws like Parser::parse().
+    explicit IncrementalParser(const TokenArray& tokens, int threads = 0);
+
+    // tokens is the previous array with edit applied: tokens outside the
+    // edit are the same apart from all later lines moving alike. Returns
+    // true when only one piece was reparsed. Throws like Parser::parse()
+    // when the edited program has an error; the next edit inside the same
+    // piece is still incremental.
+    bool update(const TokenArray& tokens, const TokenEdit& edit);
+
+    // Null while the program has an error.
+    BinTree* getST();
+};
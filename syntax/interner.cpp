@@ -0,0 +1,108 @@
+#include "interner.h"
+
+StringInterner::StringInterner() : slots(64, INTERN_NONE), textBytes(0) {}
+
+unsigned int StringInterner::hashText(string_view text) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < text.size(); i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+unsigned int StringInterner::findSlot(string_view text, unsigned int hash) const {
+    unsigned int mask = (unsigned int)slots.size() - 1;
+    unsigned int slot = hash & mask;
+    while (slots[slot] != INTERN_NONE) {
+        unsigned int id = slots[slot];
+        if (hashes[id] == hash && texts[id] == text) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void StringInterner::growSlots() {
+    vector<unsigned int> grown(slots.size() * 2, INTERN_NONE);
+    unsigned int mask = (unsigned int)grown.size() - 1;
+    for (unsigned int id = 0; id < texts.size(); id++) {
+        unsigned int slot = hashes[id] & mask;
+        while (grown[slot] != INTERN_NONE) slot = (slot + 1) & mask;
+        grown[slot] = id;
+    }
+    slots.swap(grown);
+}
+
+unsigned int StringInterner::intern(string_view text, unsigned int hash, string_view* stored) {
+    unsigned int slot = findSlot(text, hash);
+    if (slots[slot] != INTERN_NONE) {
+        if (stored) *stored = texts[slots[slot]];
+        return slots[slot];
+    }
+
+    unsigned int id = (unsigned int)texts.size();
+    string_view copy = storage.storeText(text);
+    texts.push_back(copy);
+    hashes.push_back(hash);
+    textBytes += text.size();
+    slots[slot] = id;
+    // Kept at most half full.
+    if (texts.size() * 2 > slots.size()) growSlots();
+    if (stored) *stored = copy;
+    return id;
+}
+
+unsigned int StringInterner::find(string_view text, unsigned int hash) const {
+    return slots[findSlot(text, hash)];
+}
+
+unsigned int SharedInterner::intern(string_view text, unsigned int hash, string_view* stored) {
+    // The shard comes from the high bits; the low ones pick the slot.
+    unsigned int index = hash >> (32 - SHARD_BITS);
+    Shard& shard = shards[index];
+    unsigned int id;
+    {
+        shared_lock<shared_mutex> reading(shard.lock);
+        id = shard.strings.find(text, hash);
+        if (id != INTERN_NONE && stored) *stored = shard.strings.text(id);
+    }
+    if (id == INTERN_NONE) {
+        // Another thread may have added it in between; intern finds it then.
+        unique_lock<shared_mutex> writing(shard.lock);
+        id = shard.strings.intern(text, hash, stored);
+    }
+    return id << SHARD_BITS | index;
+}
+
+unsigned int SharedInterner::find(string_view text) const {
+    unsigned int hash = StringInterner::hashText(text);
+    unsigned int index = hash >> (32 - SHARD_BITS);
+    const Shard& shard = shards[index];
+    shared_lock<shared_mutex> reading(shard.lock);
+    unsigned int id = shard.strings.find(text, hash);
+    return id == INTERN_NONE ? INTERN_NONE : id << SHARD_BITS | index;
+}
+
+string_view SharedInterner::text(unsigned int id) const {
+    const Shard& shard = shards[id & (SHARDS - 1)];
+    shared_lock<shared_mutex> reading(shard.lock);
+    return shard.strings.text(id >> SHARD_BITS);
+}
+
+unsigned int SharedInterner::size() const {
+    unsigned int total = 0;
+    for (const Shard& shard : shards) {
+        shared_lock<shared_mutex> reading(shard.lock);
+        total += shard.strings.size();
+    }
+    return total;
+}
+
+size_t SharedInterner::bytesUsed() const {
+    size_t total = 0;
+    for (const Shard& shard : shards) {
+        shared_lock<shared_mutex> reading(shard.lock);
+        total += shard.strings.bytesUsed();
+    }
+    return total;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "stnode.h"
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+const unsigned int INTERN_NONE = 0xFFFFFFFFu;
+
+// One stored copy of every distinct spelling. Each gets a 32-bit id,
+// numbered from 0 in the order first seen, and a string_view that stays
+// valid as long as the interner does, so two interned views are equal
+// exactly when their data pointers are.
+class StringInterner {
+private:
+    NodeArena storage;
+    vector<string_view> texts;      // by id
+    vector<unsigned int> hashes;    // by id, for growing the slots
+    vector<unsigned int> slots;     // open addressing, id or INTERN_NONE
+    size_t textBytes;
+
+    unsigned int findSlot(string_view text, unsigned int hash) const;
+    void growSlots();
+
+public:
+    StringInterner();
+
+    StringInterner(const StringInterner&) = delete;
+    StringInterner& operator=(const StringInterner&) = delete;
+
+    static unsigned int hashText(string_view text);
+
+    // Id of text, storing it the first time; stored, when given, is set
+    // to the interned copy.
+    unsigned int intern(string_view text, string_view* stored = nullptr) {
+        return intern(text, hashText(text), stored);
+    }
+    unsigned int intern(string_view text, unsigned int hash, string_view* stored);
+    // INTERN_NONE when text was never interned.
+    unsigned int find(string_view text) const { return find(text, hashText(text)); }
+    unsigned int find(string_view text, unsigned int hash) const;
+
+    string_view text(unsigned int id) const { return texts[id]; }
+    unsigned int size() const { return (unsigned int)texts.size(); }
+    size_t bytesUsed() const { return textBytes; }
+};
+
+// StringInterner for many threads at once, meant for lookups far
+// outnumbering new spellings, as when parser threads read files in one
+// vocabulary. Spellings are spread by hash over SHARDS interners, each
+// behind a shared_mutex: a lookup of a known spelling takes only a shared
+// lock, and a new one locks just its shard. An id carries its shard in
+// the low bits, so ids stay 32-bit and stable but are not dense.
+class SharedInterner {
+private:
+    static const int SHARD_BITS = 4;
+    static const int SHARDS = 1 << SHARD_BITS;
+
+    struct Shard {
+        mutable shared_mutex lock;
+        StringInterner strings;
+    };
+
+    Shard shards[SHARDS];
+
+public:
+    SharedInterner() {}
+
+    SharedInterner(const SharedInterner&) = delete;
+    SharedInterner& operator=(const SharedInterner&) = delete;
+
+    unsigned int intern(string_view text, string_view* stored = nullptr) {
+        return intern(text, StringInterner::hashText(text), stored);
+    }
+    unsigned int intern(string_view text, unsigned int hash, string_view* stored);
+    unsigned int find(string_view text) const;
+    string_view text(unsigned int id) const;
+
+    // The interned copy of text, for code that keeps views rather than ids.
+    string_view view(string_view text) {
+        string_view stored;
+        intern(text, &stored);
+        return stored;
+    }
+
+    // Totals over the shards, each read under its own lock.
+    unsigned int size() const;
+    size_t bytesUsed() const;
+};
+
+// One thread's front for a SharedInterner: the last spelling met in each
+// of a few hash buckets, so the names a parser sees over and over skip
+// the shard lock.
+class InternCache {
+private:
+    static const int ENTRIES = 256;
+
+    struct Entry {
+        unsigned int hash;
+        string_view text;   // interned; empty when unused
+    };
+
+    SharedInterner& pool;
+    Entry entries[ENTRIES];
+
+public:
+    explicit InternCache(SharedInterner& strings) : pool(strings), entries() {}
+
+    string_view view(string_view text) {
+        unsigned int hash = StringInterner::hashText(text);
+        Entry& entry = entries[hash & (ENTRIES - 1)];
+        if (entry.hash == hash && entry.text == text && !text.empty()) return entry.text;
+        entry.hash = hash;
+        pool.intern(text, hash, &entry.text);
+        return entry.text;
+    }
+};
@@ -0,0 +1,86 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Platform headers go first: windows.h must not see the
+// "using namespace std" from our headers (std::byte clashes with byte).
+#include "mappedfile.h"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string& filename)
+    : data(nullptr), length(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw runtime_error("Cannot open file: " + filename);
+    }
+    fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        throw runtime_error("Cannot read file size: " + filename);
+    }
+    length = (size_t)fileSize.QuadPart;
+    if (length == 0) return;
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        throw runtime_error("Cannot map file: " + filename);
+    }
+    mappingHandle = mapping;
+
+    data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw runtime_error("Cannot map file: " + filename);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle((HANDLE)mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle((HANDLE)fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const string& filename) : data(nullptr), length(0), fd(-1) {
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open file: " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw runtime_error("Cannot read file size: " + filename);
+    }
+    length = (size_t)st.st_size;
+    if (length == 0) return;
+
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        throw runtime_error("Cannot map file: " + filename);
+    }
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    data = (const char*)mapped;
+}
+
+MappedFile::~MappedFile() {
+    if (data) munmap((void*)data, length);
+    if (fd >= 0) close(fd);
+}
+
+#endif
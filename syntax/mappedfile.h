@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+using namespace std;
+
+// Read-only view of a whole file mapped into memory. Token loaders slice
+// string_views out of it, so it must outlive every token that refers to it.
+class MappedFile {
+private:
+    const char* data;
+    size_t length;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fd;
+#endif
+
+public:
+    explicit MappedFile(const string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + length; }
+    size_t size() const { return length; }
+    string_view view() const { return string_view(data, length); }
+};
@@ -0,0 +1,334 @@
+#include "native.h"
+#include "textwriter.h"
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+const int TEMP_REGISTERS = 5;
+const char* const TEMP64[TEMP_REGISTERS] = { "rbx", "r12", "r13", "r14", "r15" };
+const char* const TEMP32[TEMP_REGISTERS] = { "ebx", "r12d", "r13d", "r14d", "r15d" };
+const int ARGUMENT_REGISTERS = 6;
+const char* const ARGUMENT64[ARGUMENT_REGISTERS] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+
+// pas_write(value, first) writes value, after a space unless first is set.
+const char* const RUNTIME =
+    "pas_write:\n"
+    "\tsub rsp, 8\n"
+    "\ttest esi, esi\n"
+    "\tmov esi, edi\n"
+    "\tlea rdi, [rip + .Lfmt_next]\n"
+    "\tje 1f\n"
+    "\tlea rdi, [rip + .Lfmt_first]\n"
+    "1:\txor eax, eax\n"
+    "\tcall printf@PLT\n"
+    "\tadd rsp, 8\n"
+    "\tret\n"
+    "\n"
+    "pas_newline:\n"
+    "\tsub rsp, 8\n"
+    "\tmov edi, 10\n"
+    "\tcall putchar@PLT\n"
+    "\tadd rsp, 8\n"
+    "\tret\n"
+    "\n"
+    "pas_div_zero:\n"
+    "\tsub rsp, 8\n"
+    "\tmov edx, edi\n"
+    "\tmov edi, 2\n"
+    "\tlea rsi, [rip + .Ldiv_zero]\n"
+    "\txor eax, eax\n"
+    "\tcall dprintf@PLT\n"
+    "\tmov edi, 1\n"
+    "\tcall exit@PLT\n"
+    "\n"
+    "\t.section .rodata\n"
+    ".Lfmt_first:\n"
+    "\t.string \"%d\"\n"
+    ".Lfmt_next:\n"
+    "\t.string \" %d\"\n"
+    ".Ldiv_zero:\n"
+    "\t.string \"Runtime error at line %d: division by zero\\n\"\n";
+
+class AssemblyWriter {
+private:
+    const Bytecode& program;
+    TextWriter out;
+
+    // The function being written: its slots come first in the frame,
+    // then the temporaries that did not get a register, then the saved
+    // registers.
+    int slots;
+    int spills;
+    int saved;
+
+    void emit(const string& instruction) {
+        out.put('\t');
+        out.put(instruction);
+        out.put('\n');
+    }
+
+    void label(const string& name) {
+        out.put(name);
+        out.put(":\n");
+    }
+
+    static string frame(int offset) { return "[rbp - " + to_string(offset) + "]"; }
+    string slot(int index) const { return "qword ptr " + frame(8 * (index + 1)); }
+    string slot32(int index) const { return "dword ptr " + frame(8 * (index + 1)); }
+    static string global(int index) { return "dword ptr [rip + pas_globals + " + to_string(4 * index) + "]"; }
+    static string functionLabel(int index) { return "pas_f" + to_string(index); }
+
+    static bool inRegister(int temp) { return temp < TEMP_REGISTERS; }
+    string temp64(int temp) const {
+        return inRegister(temp) ? TEMP64[temp] : "qword ptr " + frame(8 * (slots + temp - TEMP_REGISTERS + 1));
+    }
+    string temp32(int temp) const {
+        return inRegister(temp) ? TEMP32[temp] : "dword ptr " + frame(8 * (slots + temp - TEMP_REGISTERS + 1));
+    }
+    string savedRegister(int index) const { return "qword ptr " + frame(8 * (slots + spills + index + 1)); }
+
+    // Moves between a temporary and memory; memory to memory goes
+    // through rax.
+    void load32(int temp, const string& source) {
+        if (inRegister(temp)) {
+            emit("mov " + temp32(temp) + ", " + source);
+            return;
+        }
+        emit("mov eax, " + source);
+        emit("mov " + temp32(temp) + ", eax");
+    }
+
+    void load64(int temp, const string& source) {
+        if (inRegister(temp)) {
+            emit("mov " + temp64(temp) + ", " + source);
+            return;
+        }
+        emit("mov rax, " + source);
+        emit("mov " + temp64(temp) + ", rax");
+    }
+
+    void store32(const string& target, int temp) {
+        if (inRegister(temp)) {
+            emit("mov " + target + ", " + temp32(temp));
+            return;
+        }
+        emit("mov eax, " + temp32(temp));
+        emit("mov " + target + ", eax");
+    }
+
+    void store64(const string& target, int temp) {
+        if (inRegister(temp)) {
+            emit("mov " + target + ", " + temp64(temp));
+            return;
+        }
+        emit("mov rax, " + temp64(temp));
+        emit("mov " + target + ", rax");
+    }
+
+    void arithmetic(const char* op, int left, int right) {
+        if (inRegister(left)) {
+            emit(string(op) + " " + temp32(left) + ", " + temp32(right));
+            return;
+        }
+        emit("mov eax, " + temp32(left));
+        emit(string(op) + " eax, " + temp32(right));
+        emit("mov " + temp32(left) + ", eax");
+    }
+
+    void divide(int left, int right, int line) {
+        emit("mov eax, " + temp32(left));
+        emit("mov ecx, " + temp32(right));
+        emit("test ecx, ecx");
+        emit("jne 1f");
+        emit("mov edi, " + to_string(line));
+        emit("call pas_div_zero");
+        out.put("1:");
+        emit("cmp ecx, -1");
+        emit("jne 2f");
+        emit("neg eax");
+        emit("jmp 3f");
+        out.put("2:");
+        emit("cdq");
+        emit("idiv ecx");
+        out.put("3:");
+        emit("mov " + temp32(left) + ", eax");
+    }
+
+    void call(int function, int depth) {
+        const BytecodeFunction& callee = program.functions[function];
+        int base = depth - callee.params;
+        int onStack = callee.params > ARGUMENT_REGISTERS ? callee.params - ARGUMENT_REGISTERS : 0;
+        int padding = onStack % 2 ? 8 : 0;
+        if (padding) emit("sub rsp, 8");
+        for (int i = callee.params - 1; i >= ARGUMENT_REGISTERS; i--) {
+            emit("push " + temp64(base + i));
+        }
+        for (int i = 0; i < callee.params && i < ARGUMENT_REGISTERS; i++) {
+            emit("mov " + string(ARGUMENT64[i]) + ", " + temp64(base + i));
+        }
+        emit("call " + functionLabel(function) + "\t# " + callee.name);
+        if (onStack) emit("add rsp, " + to_string(8 * onStack + padding));
+        emit("mov " + temp32(base) + ", eax");
+    }
+
+    void prologue(const string& name, int frameSlots, int params, int maxStack) {
+        slots = frameSlots;
+        spills = maxStack > TEMP_REGISTERS ? maxStack - TEMP_REGISTERS : 0;
+        saved = maxStack < TEMP_REGISTERS ? maxStack : TEMP_REGISTERS;
+        int size = 8 * (slots + spills + saved);
+        size = (size + 15) & ~15;
+
+        label(name);
+        emit("push rbp");
+        emit("mov rbp, rsp");
+        if (size) emit("sub rsp, " + to_string(size));
+        for (int i = 0; i < saved; i++) emit("mov " + savedRegister(i) + ", " + TEMP64[i]);
+        for (int i = 0; i < params; i++) {
+            if (i < ARGUMENT_REGISTERS) {
+                emit("mov " + slot(i) + ", " + ARGUMENT64[i]);
+            }
+            else {
+                emit("mov rax, qword ptr [rbp + " + to_string(16 + 8 * (i - ARGUMENT_REGISTERS)) + "]");
+                emit("mov " + slot(i) + ", rax");
+            }
+        }
+        for (int i = params; i < slots; i++) emit("mov " + slot(i) + ", 0");
+    }
+
+    void epilogue() {
+        for (int i = 0; i < saved; i++) emit("mov " + string(TEMP64[i]) + ", " + savedRegister(i));
+        emit("leave");
+        emit("ret");
+    }
+
+    // One function's code, up to and including its RETURN or HALT.
+    void body(int pc) {
+        const vector<int>& code = program.code;
+        int depth = 0;
+        for (;;) {
+            int op = code[pc];
+            const int* operand = code.data() + pc + 1;
+            pc += 1 + opcodeOperands(op);
+            switch (op) {
+            case OP_PUSH:
+                emit("mov " + temp32(depth++) + ", " + to_string(operand[0]));
+                break;
+            case OP_LOAD_GLOBAL:
+                load32(depth++, global(operand[0]));
+                break;
+            case OP_STORE_GLOBAL:
+                store32(global(operand[0]), --depth);
+                break;
+            case OP_LOAD_LOCAL:
+                load64(depth++, slot(operand[0]));
+                break;
+            case OP_STORE_LOCAL:
+                store64(slot(operand[0]), --depth);
+                break;
+            case OP_LOAD_REF:
+                emit("mov rax, " + slot(operand[0]));
+                load32(depth++, "dword ptr [rax]");
+                break;
+            case OP_STORE_REF:
+                emit("mov rcx, " + slot(operand[0]));
+                store32("dword ptr [rcx]", --depth);
+                break;
+            case OP_ADDR_GLOBAL:
+                emit("lea rax, [rip + pas_globals + " + to_string(4 * operand[0]) + "]");
+                emit("mov " + temp64(depth++) + ", rax");
+                break;
+            case OP_ADDR_LOCAL:
+                emit("lea rax, " + frame(8 * (operand[0] + 1)));
+                emit("mov " + temp64(depth++) + ", rax");
+                break;
+            case OP_ADD:
+                depth--;
+                arithmetic("add", depth - 1, depth);
+                break;
+            case OP_SUB:
+                depth--;
+                arithmetic("sub", depth - 1, depth);
+                break;
+            case OP_MUL:
+                depth--;
+                if (inRegister(depth - 1)) {
+                    emit("imul " + temp32(depth - 1) + ", " + temp32(depth));
+                }
+                else {
+                    emit("mov eax, " + temp32(depth - 1));
+                    emit("imul eax, " + temp32(depth));
+                    emit("mov " + temp32(depth - 1) + ", eax");
+                }
+                break;
+            case OP_DIV:
+                depth--;
+                divide(depth - 1, depth, operand[0]);
+                break;
+            case OP_CALL:
+                call(operand[0], depth);
+                depth += 1 - program.functions[operand[0]].params;
+                break;
+            case OP_RETURN:
+                emit("mov eax, " + slot32(operand[0]));
+                epilogue();
+                return;
+            case OP_POP:
+                depth--;
+                break;
+            case OP_WRITELN:
+                // The values sit in callee-saved registers or the frame,
+                // so the calls leave the ones not yet written alone.
+                depth -= operand[0];
+                for (int i = 0; i < operand[0]; i++) {
+                    emit("mov edi, " + temp32(depth + i));
+                    emit(string("mov esi, ") + (i ? "0" : "1"));
+                    emit("call pas_write");
+                }
+                emit("call pas_newline");
+                break;
+            case OP_HALT:
+                emit("xor eax, eax");
+                epilogue();
+                return;
+            default:
+                throw runtime_error("Compile error: bad opcode " + to_string(op));
+            }
+        }
+    }
+
+public:
+    AssemblyWriter(const Bytecode& p, ostream& o) : program(p), out(o), slots(0), spills(0), saved(0) {}
+
+    void write() {
+        emit(".intel_syntax noprefix");
+        emit(".text");
+        for (size_t i = 0; i < program.functions.size(); i++) {
+            const BytecodeFunction& function = program.functions[i];
+            out.put("\n# " + function.name + "\n");
+            prologue(functionLabel((int)i), function.frameSize, function.params, function.maxStack);
+            body(function.entry);
+        }
+
+        out.put("\n");
+        emit(".globl main");
+        prologue("main", 0, 0, program.maxStack);
+        body(program.entry);
+
+        out.put("\n");
+        out.put(RUNTIME);
+        emit(".bss");
+        emit(".p2align 2");
+        label("pas_globals");
+        emit(".zero " + to_string(4 * (program.globals > 0 ? program.globals : 1)));
+        emit(".section .note.GNU-stack,\"\",@progbits");
+        out.flush();
+    }
+};
+
+}
+
+void writeAssembly(const Bytecode& program, ostream& out) {
+    AssemblyWriter writer(program, out);
+    writer.write();
+}
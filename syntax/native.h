@@ -0,0 +1,20 @@
+#pragma once
+#include "vm.h"
+#include <ostream>
+
+using namespace std;
+
+// Lowers compiled bytecode to x86-64 assembly for the GNU assembler
+// (Intel syntax), ready to link with the C library: cc -o prog prog.s.
+//
+// The bytecode has no branches, so the operand stack's depth is known at
+// every instruction; depth i is a fixed register, rbx and r12-r15 for the
+// first five and a frame slot after that. Those registers are callee
+// saved, so temporaries survive calls without spilling. Functions follow
+// the System V ABI: arguments in rdi, rsi, rdx, rcx, r8, r9 and then on
+// the stack, the result in eax; a var argument is passed as a pointer.
+//
+// The program prints what runBytecode would, with writeln through printf.
+// Division by zero prints the same error on stderr and exits with status
+// 1. Calls are not depth checked; the parser rejects recursion anyway.
+void writeAssembly(const Bytecode& program, ostream& out);
@@ -0,0 +1,160 @@
+#include "parseprofile.h"
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+
+const char* profileRuleName(int rule) {
+    static const char* const names[PROF_RULE_COUNT] = {
+        "Program", "parseDecls", "ConstDec", "VarDec", "FunctionDec", "skipFunctionBody",
+        "ParamList", "Param", "parseMainBlock", "parseStmts", "CompoundState", "Stmnt",
+        "AssignOrCall", "WriteLnStmnt", "Expression", "SimpleExpr", "Term", "Factor",
+        "Id", "Type", "Numbers", "node building",
+        "symbols.enterScope", "symbols.exitScope", "symbols.declare", "symbols.getKind",
+        "symbols.setParamCount", "symbols.getParamCount"
+    };
+    return (rule >= 0 && rule < PROF_RULE_COUNT) ? names[rule] : "";
+}
+
+struct RuleStats {
+    long long calls;
+    long long inclusiveNanos;
+    long long exclusiveNanos;
+    long long tokens;
+};
+
+#ifdef SYNTAX_PROFILE
+
+static mutex totalsLock;
+static RuleStats totals[PROF_RULE_COUNT];
+
+// One thread's counters; folded into totals when the thread ends.
+struct ThreadProfile {
+    RuleStats stats[PROF_RULE_COUNT];
+    int active[PROF_RULE_COUNT];    // activations of each rule now running
+
+    ThreadProfile() {
+        for (int i = 0; i < PROF_RULE_COUNT; i++) {
+            stats[i] = RuleStats{ 0, 0, 0, 0 };
+            active[i] = 0;
+        }
+    }
+
+    ~ThreadProfile() {
+        flush();
+    }
+
+    void flush() {
+        lock_guard<mutex> guard(totalsLock);
+        for (int i = 0; i < PROF_RULE_COUNT; i++) {
+            totals[i].calls += stats[i].calls;
+            totals[i].inclusiveNanos += stats[i].inclusiveNanos;
+            totals[i].exclusiveNanos += stats[i].exclusiveNanos;
+            totals[i].tokens += stats[i].tokens;
+            stats[i] = RuleStats{ 0, 0, 0, 0 };
+        }
+    }
+};
+
+static thread_local ThreadProfile threadProfile;
+thread_local ProfileScope* ProfileScope::current = nullptr;
+
+void ProfileScope::begin() {
+    threadProfile.active[rule]++;
+    current = this;
+}
+
+void ProfileScope::finish(long long nanos, int tokens) {
+    // The outermost activation of a recursive rule already covers the inner
+    // ones, so only it adds inclusive time and tokens.
+    ThreadProfile& profile = threadProfile;
+    RuleStats& stats = profile.stats[rule];
+    stats.calls++;
+    stats.exclusiveNanos += nanos - childNanos;
+    if (--profile.active[rule] == 0) {
+        stats.inclusiveNanos += nanos;
+        stats.tokens += tokens;
+    }
+
+    if (parent) parent->childNanos += nanos;
+    current = parent;
+}
+
+bool profileCompiledIn() {
+    return true;
+}
+
+static void collect(RuleStats* out) {
+    threadProfile.flush();
+    lock_guard<mutex> guard(totalsLock);
+    for (int i = 0; i < PROF_RULE_COUNT; i++) out[i] = totals[i];
+}
+
+#else
+
+bool profileCompiledIn() {
+    return false;
+}
+
+static void collect(RuleStats* out) {
+    for (int i = 0; i < PROF_RULE_COUNT; i++) out[i] = RuleStats{ 0, 0, 0, 0 };
+}
+
+#endif
+
+// Rules that ran, by exclusive time.
+static int sortedRules(const RuleStats* stats, int* order) {
+    int count = 0;
+    for (int i = 0; i < PROF_RULE_COUNT; i++) {
+        if (stats[i].calls > 0) order[count++] = i;
+    }
+    sort(order, order + count, [stats](int a, int b) {
+        return stats[a].exclusiveNanos > stats[b].exclusiveNanos;
+    });
+    return count;
+}
+
+void printProfile(ostream& out) {
+    if (!profileCompiledIn()) {
+        out << "Parse profile: not compiled in (define SYNTAX_PROFILE)" << endl;
+        return;
+    }
+
+    RuleStats stats[PROF_RULE_COUNT];
+    collect(stats);
+    int order[PROF_RULE_COUNT];
+    int count = sortedRules(stats, order);
+
+    long long total = 0;
+    for (int i = 0; i < count; i++) total += stats[order[i]].exclusiveNanos;
+
+    out << "Parse profile: " << fixed << setprecision(3) << total / 1e6 << " ms measured" << endl;
+    out << "  " << left << setw(24) << "rule" << right << setw(12) << "calls" << setw(12) << "incl ms"
+        << setw(12) << "excl ms" << setw(8) << "excl%" << setw(12) << "tokens" << endl;
+    for (int i = 0; i < count; i++) {
+        const RuleStats& rule = stats[order[i]];
+        out << "  " << left << setw(24) << profileRuleName(order[i]) << right
+            << setw(12) << rule.calls
+            << setw(12) << setprecision(3) << rule.inclusiveNanos / 1e6
+            << setw(12) << rule.exclusiveNanos / 1e6
+            << setw(8) << setprecision(1) << (total ? 100.0 * rule.exclusiveNanos / total : 0.0)
+            << setw(12) << rule.tokens << endl;
+    }
+    out << defaultfloat;
+}
+
+void writeProfileJson(ostream& out) {
+    RuleStats stats[PROF_RULE_COUNT];
+    collect(stats);
+    int order[PROF_RULE_COUNT];
+    int count = sortedRules(stats, order);
+
+    out << "{\"compiledIn\":" << (profileCompiledIn() ? "true" : "false") << ",\"rules\":[";
+    for (int i = 0; i < count; i++) {
+        const RuleStats& rule = stats[order[i]];
+        if (i) out << ",";
+        out << "\n  {\"name\":\"" << profileRuleName(order[i]) << "\",\"calls\":" << rule.calls
+            << ",\"inclusiveNs\":" << rule.inclusiveNanos << ",\"exclusiveNs\":" << rule.exclusiveNanos
+            << ",\"tokens\":" << rule.tokens << "}";
+    }
+    out << "\n]}" << endl;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <ostream>
+
+#ifdef SYNTAX_PROFILE
+#include "tokenstream.h"
+#include <chrono>
+#endif
+
+using namespace std;
+
+// Per-rule counters for the parser, compiled in only when SYNTAX_PROFILE is
+// defined; otherwise PROFILE_RULE and PROFILE_SYMBOL expand to nothing.
+//
+// Each grammar rule, node construction and symbol table operation counts
+// its calls, inclusive time (outermost activation only, so recursion is
+// not counted twice), exclusive time (minus the rules it called) and the
+// tokens consumed while it ran. Counters are per thread and add up into
+// one table when a thread ends or a report is made, so batch and parallel
+// parses are covered.
+enum ProfileRule : unsigned char {
+    PROF_PROGRAM,
+    PROF_DECLARATIONS,
+    PROF_CONST_DEC,
+    PROF_VAR_DEC,
+    PROF_FUNCTION_DEC,
+    PROF_SKIP_BODY,
+    PROF_PARAM_LIST,
+    PROF_PARAM,
+    PROF_MAIN_BLOCK,
+    PROF_STATEMENTS,
+    PROF_COMPOUND,
+    PROF_STATEMENT,
+    PROF_ASSIGN_OR_CALL,
+    PROF_WRITELN,
+    PROF_EXPRESSION,
+    PROF_SIMPLE_EXPR,
+    PROF_TERM,
+    PROF_FACTOR,
+    PROF_ID,
+    PROF_TYPE,
+    PROF_NUMBERS,
+    PROF_NODE,
+    PROF_SYM_ENTER_SCOPE,
+    PROF_SYM_EXIT_SCOPE,
+    PROF_SYM_DECLARE,
+    PROF_SYM_GET_KIND,
+    PROF_SYM_SET_PARAMS,
+    PROF_SYM_GET_PARAMS,
+    PROF_RULE_COUNT
+};
+
+const char* profileRuleName(int rule);
+
+#ifdef SYNTAX_PROFILE
+
+class ProfileScope {
+private:
+    typedef chrono::steady_clock Clock;
+
+    ProfileRule rule;
+    const TokenStream* stream;
+    int startPosition;
+    ProfileScope* parent;
+    long long childNanos;
+    Clock::time_point start;
+
+    static thread_local ProfileScope* current;
+
+    void begin();
+    void finish(long long nanos, int tokens);
+
+public:
+    // stream is the parser's token stream, or null outside the parser.
+    ProfileScope(ProfileRule r, const TokenStream* s)
+        : rule(r), stream(s), startPosition(s ? s->position() : 0), parent(current), childNanos(0) {
+        begin();
+        start = Clock::now();
+    }
+
+    ~ProfileScope() {
+        long long nanos = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+        finish(nanos, stream ? stream->position() - startPosition : 0);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#define PROFILE_RULE(rule, stream) ProfileScope profileScope(rule, &(stream))
+#define PROFILE_SYMBOL(rule) ProfileScope profileScope(rule, nullptr)
+
+#else
+
+#define PROFILE_RULE(rule, stream) ((void)0)
+#define PROFILE_SYMBOL(rule) ((void)0)
+
+#endif
+
+// False when SYNTAX_PROFILE was not defined; the reports are then empty.
+bool profileCompiledIn();
+
+// Rules by exclusive time, as a table or as one JSON object. Both add in
+// the calling thread's counters first; threads still running are not seen.
+void printProfile(ostream& out);
+void writeProfileJson(ostream& out);
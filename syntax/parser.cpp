@@ -1,18 +1,12 @@
 #include "parser.h"
+#include "parseprofile.h"
+#include "threadpool.h"
 
-const int ID = 0;
-const int HEXNUM = 1;
-const int DECNUM = 2;
-const int SEP = 3;
-const int KEYWORD = 4;
-
-static STNode* cloneNode(const STNode* node) {
-    if (!node) return nullptr;
-    STNode* copy = new STNode(node->getData());
-    copy->setLeft(cloneNode(node->getLeft()));
-    copy->setRight(cloneNode(node->getRight()));
-    return copy;
-}
+const int ID = TOKEN_ID;
+const int HEXNUM = TOKEN_HEXNUM;
+const int DECNUM = TOKEN_DECNUM;
+const int SEP = TOKEN_SEP;
+const int KEYWORD = TOKEN_KEYWORD;
 
 int Parser::countParams(STNode* paramsNode) {
     if (!paramsNode) return 0;
@@ -61,98 +55,176 @@ int Parser::countArguments(STNode* argsNode) {
 }
 
 void Parser::enterScope() {
-    if (scopeCount >= scopeCapacity) {
-        int newCap = scopeCapacity * 2;
-        Scope** newScopes = new Scope * [newCap];
-        for (int i = 0; i < scopeCount; ++i) {
-            newScopes[i] = scopes[i];
-        }
-        delete[] scopes;
-        scopes = newScopes;
-        scopeCapacity = newCap;
-    }
-    scopes[scopeCount++] = new Scope();
+    symbols.enterScope();
 }
 
 void Parser::exitScope() {
-    if (scopeCount <= 1) return;
-    delete scopes[--scopeCount];
-}
-
-void Parser::addToCurrentScope(const string& name, const string& kind) {
-    scopes[scopeCount - 1]->add(name, kind);
+    symbols.exitScope();
 }
 
-string Parser::getIdentifierKind(const string& name) const {
-    for (int i = scopeCount - 1; i >= 0; --i) {
-        string kind = scopes[i]->getKind(name);
-        if (!kind.empty()) return kind;
-    }
-    return "";
+bool Parser::addToCurrentScope(const STNode* id, SymbolKind kind) {
+    if (symbols.tryDeclare(id->getData().value, kind)) return true;
+    semanticError(diagnosticFor(DIAG_REDECLARED, id));
+    return false;
 }
 
-bool Parser::isDeclaredInScopes(const string& name) const {
-    return !getIdentifierKind(name).empty();
+SymbolKind Parser::getIdentifierKind(string_view name) const {
+    return symbols.getKind(name);
 }
 
-Token Parser::currentToken() const {
-    return current < tokens.size() ? tokens[current] : Token(-1, "", "");
+bool Parser::isDeclaredInScopes(string_view name) const {
+    return symbols.contains(name);
 }
 
 void Parser::advance() {
-    if (current < tokens.size()) current++;
+    tokens.advance();
 }
 
-bool Parser::match(int expectedTypeCode, const string& expectedValue) const {
-    if (current >= tokens.size()) return false;
-    const Token& token = tokens[current];
-    int tokenType = tokenTypeCode(token.type);
-    if (tokenType != expectedTypeCode) return false;
-    if (!expectedValue.empty() && token.value != expectedValue) return false;
+bool Parser::match(int expectedTypeCode, int expectedLexeme) const {
+    if (failed || tokens.atEnd()) return false;
+    const Token& token = tokens.peek();
+    if (token.kind != expectedTypeCode) return false;
+    if (expectedLexeme != LX_NONE && token.lexeme != expectedLexeme) return false;
     return true;
 }
 
-void Parser::consume(int expectedTypeCode, const string& expectedValue) {
-    if (!match(expectedTypeCode, expectedValue)) {
-        string typeStr;
-        switch (expectedTypeCode) {
-        case ID: typeStr = "identifier"; break;
-        case HEXNUM: typeStr = "hex number"; break;
-        case DECNUM: typeStr = "decimal number"; break;
-        case SEP: typeStr = "separator"; break;
-        case KEYWORD: typeStr = "keyword"; break;
-        default: typeStr = "token type " + to_string(expectedTypeCode);
+void Parser::consume(int expectedTypeCode, int expectedLexeme) {
+    if (!match(expectedTypeCode, expectedLexeme)) {
+        // Every rule after the first error lands here; it costs nothing.
+        if (failed) return;
+        ParseDiagnostic diagnostic = diagnosticHere(DIAG_EXPECTED_TOKEN);
+        diagnostic.expectedKind = (unsigned char)expectedTypeCode;
+        diagnostic.expectedLexeme = (unsigned char)expectedLexeme;
+        if (!tokens.atEnd()) {
+            const Token& token = tokens.peek();
+            diagnostic.foundKind = token.kind;
+            diagnostic.text = storeText(token.value);
         }
+        syntaxError(diagnostic);
+        return;
+    }
+    advance();
+}
 
-        string lineInfo = "";
-        if (current < tokens.size() && tokens[current].line != -1) {
-            lineInfo = " at line " + to_string(tokens[current].line);
-        }
+void Parser::syntaxError(const ParseDiagnostic& diagnostic) {
+    if (!failed) diagnostics.push_back(diagnostic);
+    failed = true;
+}
+
+void Parser::semanticError(const ParseDiagnostic& diagnostic) {
+    if (!failed) diagnostics.push_back(diagnostic);
+    if (!recovering) failed = true;
+}
+
+ParseDiagnostic Parser::diagnosticHere(DiagnosticCode code) const {
+    ParseDiagnostic diagnostic(code, tokens.position(), currentLine());
+    diagnostic.endOfInput = tokens.atEnd();
+    return diagnostic;
+}
+
+ParseDiagnostic Parser::diagnosticFor(DiagnosticCode code, const STNode* id) {
+    const STData& data = id->getData();
+    return ParseDiagnostic(code, data.token, data.line, data.value);
+}
+
+int Parser::currentLine() const {
+    return tokens.atEnd() ? -1 : tokens.peek().line;
+}
 
-        string error = "Syntax error" + lineInfo + ": expected " + typeStr;
-        if (!expectedValue.empty()) error += " '" + expectedValue + "'";
-        error += ", but found ";
-        if (current < tokens.size()) {
-            const Token& token = tokens[current];
-            error += token.type;
-            if (!token.value.empty()) error += " '" + token.value + "'";
+static bool isDeclarationKeyword(const Token& token) {
+    return token.kind == TOKEN_KEYWORD &&
+        (token.lexeme == KW_CONST || token.lexeme == KW_VAR || token.lexeme == KW_FUNCTION);
+}
+
+void Parser::resyncStatement() {
+    if (!recovering) return;
+    failed = false;
+    while (!tokens.atEnd()) {
+        if (match(SEP, SEP_SEMICOLON)) {
+            advance();
+            return;
         }
-        else {
-            error += "end of file";
+        if (match(KEYWORD, KW_END) || match(SEP, SEP_DOT) || isDeclarationKeyword(tokens.peek())) return;
+        advance();
+    }
+}
+
+void Parser::resyncDeclaration() {
+    if (!recovering) return;
+    failed = false;
+    while (!tokens.atEnd() && !isDeclarationKeyword(tokens.peek()) && !match(KEYWORD, KW_BEGIN)) {
+        advance();
+    }
+}
+
+void Parser::resyncDeclarationItem() {
+    if (!recovering) return;
+    failed = false;
+    while (!tokens.atEnd()) {
+        if (match(SEP, SEP_SEMICOLON)) {
+            advance();
+            return;
         }
-        throw runtime_error(error);
+        if (match(KEYWORD) && !match(KEYWORD, KW_INTEGER)) return;
+        advance();
     }
-    advance();
 }
 
-STNode* Parser::createNode(const string& type, const string& value, int line) {
-    if (line == -1 && current < tokens.size()) {
-        line = tokens[current].line;
+// 'var' and 'const' inside the parameter list belong to the header.
+void Parser::resyncFunctionHeader() {
+    if (!recovering) return;
+    failed = false;
+    int depth = 0;
+    while (!tokens.atEnd()) {
+        if (match(SEP, SEP_LPAREN)) depth++;
+        else if (match(SEP, SEP_RPAREN) && depth > 0) depth--;
+        else if (depth == 0 && (match(KEYWORD, KW_VAR) || match(KEYWORD, KW_CONST) ||
+            match(KEYWORD, KW_BEGIN) || match(KEYWORD, KW_FUNCTION))) return;
+        advance();
+    }
+}
+
+string_view Parser::storeText(string_view text) {
+    return strings ? stringCache->view(text) : stTree->storeText(text);
+}
+
+void Parser::setInterner(SharedInterner* pool) {
+    strings = pool;
+    stringCache.reset(pool ? new InternCache(*pool) : nullptr);
+}
+
+STNode* Parser::createNode(string_view type, string_view value, int line) {
+    PROFILE_RULE(PROF_NODE, tokens);
+    if (line == -1 && !tokens.atEnd()) {
+        line = tokens.peek().line;
+    }
+    return stTree->newNode(STData(type, value.empty() ? value : storeText(value), line));
+}
+
+STNode* Parser::createTokenNode(string_view type) {
+    PROFILE_RULE(PROF_NODE, tokens);
+    const Token& token = tokens.peek();
+    return stTree->newNode(STData(type, storeText(token.value), token.line, tokens.position()));
+}
+
+void Parser::appendSeq(SeqList& list, STNode* item) {
+    if (!item) return;
+    if (!list.head) {
+        list.head = item;
+    }
+    else if (!list.tail) {
+        list.tail = makeSeq(list.head, item);
+        list.head = list.tail;
+    }
+    else {
+        STNode* seq = makeSeq(list.tail->getRight(), item);
+        list.tail->setRight(seq);
+        list.tail = seq;
     }
-    return new STNode(STData(type, value, line));
 }
 
 STNode* Parser::makeSeq(STNode* left, STNode* right) {
+    PROFILE_RULE(PROF_NODE, tokens);
     if (!left) return right;
     if (!right) return left;
     STNode* seq = createNode("SEQ", "");
@@ -161,35 +233,160 @@ STNode* Parser::makeSeq(STNode* left, STNode* right) {
     return seq;
 }
 
-Parser::Parser(const TokenArray& tokenArray)
-    : tokens(tokenArray), current(0), stTree(new BinTree()),
-    scopes(nullptr), scopeCount(0), scopeCapacity(0), inDeclaration(false),
-    funcTable(new FunctionTable()) {
-    scopeCapacity = 4;
-    scopes = new Scope * [scopeCapacity];
-    scopes[scopeCount++] = new Scope();
+Parser::Parser(const TokenArray& array)
+    : tokenArray(&array), arrayTokens(array), tokens(arrayTokens), stTree(new BinTree()), strings(nullptr),
+    inDeclaration(false), verbose(true), bodyMode(BODIES_INLINE),
+    mainBlockParent(nullptr), recordStatements(false), splitParse(false),
+    recovering(false), failed(false) {
+}
+
+Parser::Parser(TokenStream& tokenStream)
+    : tokenArray(nullptr), tokens(tokenStream), stTree(new BinTree()), strings(nullptr),
+    inDeclaration(false), verbose(true), bodyMode(BODIES_INLINE),
+    mainBlockParent(nullptr), recordStatements(false), splitParse(false),
+    recovering(false), failed(false) {
+}
+
+Parser::Parser(const TokenArray& array, int start, const SymbolTable& globals, int visibleGlobals,
+    bool insideFunction)
+    : tokenArray(&array), arrayTokens(array, start), tokens(arrayTokens), stTree(new BinTree()), strings(nullptr),
+    inDeclaration(false), verbose(false), bodyMode(BODY_ONLY),
+    mainBlockParent(nullptr), recordStatements(false), splitParse(false),
+    recovering(false), failed(false) {
+    symbols.setOuter(&globals, visibleGlobals, insideFunction);
 }
 
 Parser::~Parser() {
-    for (int i = 0; i < scopeCount; ++i) {
-        delete scopes[i];
-    }
-    delete[] scopes;
     delete stTree;
-    delete funcTable;
 }
 
 void Parser::parse() {
+    string error;
     try {
-        STNode* rootNode = Program();
-        stTree->setRoot(rootNode);
-        cout << "Parsing completed successfully!" << endl;
+        if (tryParse()) return;
+        error = diagnostics.front().message(true);
+        diagnostics.clear();
     }
     catch (const exception& e) {
+        // Only the token source throws, e.g. a TokenPipeline's read error.
+        error = e.what();
+    }
+    delete stTree;
+    stTree = nullptr;
+    throw runtime_error("Parsing failed: " + error);
+}
+
+bool Parser::tryParse() {
+    failed = false;
+    diagnostics.clear();
+    STNode* rootNode = Program();
+    if (!diagnostics.empty()) return false;
+    stTree->setRoot(rootNode);
+    if (verbose) cout << "Parsing completed successfully!" << endl;
+    return true;
+}
+
+bool Parser::parseWithRecovery() {
+    recovering = true;
+    failed = false;
+    diagnostics.clear();
+    stTree->setRoot(Program());
+    recovering = false;
+    failed = false;
+    if (verbose && diagnostics.empty()) cout << "Parsing completed successfully!" << endl;
+    return diagnostics.empty();
+}
+
+void Parser::parseParallel(int threads) {
+    if (!tokenArray) {
+        parse();
+        return;
+    }
+
+    struct Body {
+        BinTree* tree;
+        STNode* funcNode;
+    };
+    vector<Body> bodies;
+    bool complete = false;
+    deferred.clear();
+    mainStatements.clear();
+    splitParse = false;
+
+    try {
+        bodyMode = BODIES_DEFERRED;
+        STNode* rootNode = Program();
+        bodyMode = BODIES_INLINE;
+        // After an error in phase one there is nothing to split; the
+        // sequential rerun reports it.
+        if (failed) deferred.clear();
+
+        bodies.assign(deferred.size(), Body{ nullptr, nullptr });
+        if (!deferred.empty()) {
+            WorkStealingPool pool(threads);
+            for (size_t i = 0; i < deferred.size(); i++) {
+                pool.submit([this, &bodies, i] {
+                    const DeferredBody& item = deferred[i];
+                    Parser body(*tokenArray, item.start, symbols, item.visibleGlobals);
+                    body.setInterner(strings);
+                    try {
+                        STNode* funcNode = body.FunctionDec();
+                        if (body.failed || body.tokens.position() != item.end) return;
+                        bodies[i].funcNode = funcNode;
+                        bodies[i].tree = body.stTree;
+                        body.stTree = nullptr;
+                    }
+                    catch (const exception&) {
+                        // Out of memory; left empty like a failed body.
+                    }
+                });
+            }
+            pool.wait();
+        }
+
+        complete = !failed;
+        for (size_t i = 0; i < bodies.size(); i++) {
+            if (!bodies[i].funcNode) complete = false;
+        }
+        if (complete) {
+            for (size_t i = 0; i < bodies.size(); i++) {
+                deferred[i].funcNode->setLeft(bodies[i].funcNode->getLeft());
+                deferred[i].funcNode->setRight(bodies[i].funcNode->getRight());
+                stTree->getArena().adopt(bodies[i].tree->getArena());
+            }
+            stTree->setRoot(rootNode);
+        }
+    }
+    catch (const exception&) {
+        complete = false;
+    }
+
+    for (size_t i = 0; i < bodies.size(); i++) {
+        delete bodies[i].tree;
+    }
+    bodyMode = BODIES_INLINE;
+    splitParse = complete;
+
+    if (!complete) {
+        deferred.clear();
+        mainStatements.clear();
+        failed = false;
+        diagnostics.clear();
+        Parser sequential(*tokenArray);
+        sequential.setVerbose(false);
+        try {
+            sequential.parse();
+        }
+        catch (const exception&) {
+            delete stTree;
+            stTree = nullptr;
+            throw;
+        }
         delete stTree;
-        stTree = nullptr;
-        throw runtime_error(string("Parsing failed: ") + e.what());
+        stTree = sequential.stTree;
+        sequential.stTree = nullptr;
     }
+    if (verbose) cout << "Parsing completed successfully!" << endl;
 }
 
 BinTree* Parser::getST() {
@@ -208,26 +405,33 @@ void Parser::print() const {
 void Parser::saveTreeToFile(const string& filename) const {
     if (stTree) {
         stTree->saveToFile(filename);
-        cout << "Syntax tree saved to '" << filename << "'" << endl;
+        if (verbose) cout << "Syntax tree saved to '" << filename << "'" << endl;
     }
 }
 
 STNode* Parser::Program() {
+    PROFILE_RULE(PROF_PROGRAM, tokens);
     STNode* progName = nullptr;
 
-    if (match(KEYWORD, "program")) {
-        consume(KEYWORD, "program");
+    if (match(KEYWORD, KW_PROGRAM)) {
+        consume(KEYWORD, KW_PROGRAM);
         inDeclaration = true;
         progName = Id();
         inDeclaration = false;
-        addToCurrentScope(progName->getData().value, "var");
-        consume(SEP, ";");
+        addToCurrentScope(progName, SYM_VAR);
+        consume(SEP, SEP_SEMICOLON);
     }
 
     STNode* decls = parseDecls();
 
-    if (!match(KEYWORD, "begin")) {
-        throw runtime_error("Syntax error: expected 'begin' after declarations");
+    if (!failed && !match(KEYWORD, KW_BEGIN)) {
+        syntaxError(diagnosticHere(DIAG_EXPECTED_BEGIN));
+    }
+    if (failed && recovering) {
+        // Resume at the main block if there is one.
+        failed = false;
+        while (!tokens.atEnd() && !match(KEYWORD, KW_BEGIN)) advance();
+        failed = tokens.atEnd();
     }
 
     STNode* body = parseMainBlock();
@@ -244,43 +448,53 @@ STNode* Parser::Program() {
     }
 
     programNode->setRight(declarationsAndBody);
+    if (body) {
+        mainBlockParent = declarationsAndBody == body ? programNode : declarationsAndBody;
+    }
     return programNode;
 }
 
 STNode* Parser::parseMainBlock() {
-    consume(KEYWORD, "begin");
+    PROFILE_RULE(PROF_MAIN_BLOCK, tokens);
+    consume(KEYWORD, KW_BEGIN);
 
-    if (match(KEYWORD, "var")) {
-        throw runtime_error("Syntax error: variable declarations must be before 'begin' in main block");
+    if (match(KEYWORD, KW_VAR)) {
+        semanticError(diagnosticHere(DIAG_VAR_IN_MAIN_BLOCK));
+        // Recovering: read them anyway, so later uses are not undeclared.
+        VarDec();
     }
 
+    recordStatements = bodyMode == BODIES_DEFERRED;
     STNode* body = parseStmts();
-    consume(KEYWORD, "end");
-    consume(SEP, ".");
+    consume(KEYWORD, KW_END);
+    consume(SEP, SEP_DOT);
 
     return body;
 }
 
-STNode* Parser::ConstDec() {
-    consume(KEYWORD, "const");
+STNode* Parser::ConstDec(SeqList* decls) {
+    PROFILE_RULE(PROF_CONST_DEC, tokens);
+    consume(KEYWORD, KW_CONST);
     STNode* result = nullptr;
 
     while (match(ID)) {
         inDeclaration = true;
         STNode* idNode = Id();
         inDeclaration = false;
-        addToCurrentScope(idNode->getData().value, "const");
+        addToCurrentScope(idNode, SYM_CONST);
 
-        consume(SEP, "=");
+        consume(SEP, SEP_EQUAL);
         STNode* valueNode = Numbers();
-        consume(SEP, ";");
+        consume(SEP, SEP_SEMICOLON);
+
+        if (failed) resyncDeclarationItem();
 
         STNode* constDecl = createNode("CONST_DECL", "");
         constDecl->setLeft(idNode);
         constDecl->setRight(valueNode);
 
-        if (!result) {
-            result = constDecl;
+        if (decls) {
+            appendSeq(*decls, constDecl);
         }
         else {
             result = makeSeq(result, constDecl);
@@ -289,88 +503,83 @@ STNode* Parser::ConstDec() {
     return result;
 }
 
-STNode* Parser::VarDec() {
-    consume(KEYWORD, "var");
+STNode* Parser::VarDec(SeqList* decls) {
+    PROFILE_RULE(PROF_VAR_DEC, tokens);
+    consume(KEYWORD, KW_VAR);
     STNode* result = nullptr;
 
     while (match(ID)) {
-        const int MAX_IDS = 100;
-        STNode* ids[MAX_IDS];
-        int count = 0;
+        SeqList group;
 
         do {
             inDeclaration = true;
             STNode* id = Id();
             inDeclaration = false;
-            addToCurrentScope(id->getData().value, "var");
+            addToCurrentScope(id, SYM_VAR);
 
-            if (count < MAX_IDS) {
-                id->setLeft(nullptr);
-                id->setRight(nullptr);
-                ids[count++] = id;
-            }
-        } while (match(SEP, ",") && (consume(SEP, ","), true));
-
-        consume(SEP, ":");
-        consume(KEYWORD, "integer");
-        consume(SEP, ";");
-
-        STNode* currentResult = nullptr;
-        for (int i = count - 1; i >= 0; i--) {
             STNode* varDecl = createNode("VAR_DECL", "");
-            varDecl->setLeft(cloneNode(ids[i]));
+            varDecl->setLeft(id);
             varDecl->setRight(createNode("TYPE", "INTEGER"));
+            appendSeq(decls ? *decls : group, varDecl);
+        } while (match(SEP, SEP_COMMA) && (consume(SEP, SEP_COMMA), true));
 
-            if (!currentResult) {
-                currentResult = varDecl;
-            }
-            else {
-                currentResult = makeSeq(varDecl, currentResult);
-            }
-        }
+        consume(SEP, SEP_COLON);
+        consume(KEYWORD, KW_INTEGER);
+        consume(SEP, SEP_SEMICOLON);
+        if (failed) resyncDeclarationItem();
 
-        if (!result) {
-            result = currentResult;
-        }
-        else {
-            result = makeSeq(result, currentResult);
-        }
+        result = makeSeq(result, group.head);
     }
     return result;
 }
 
 STNode* Parser::FunctionDec() {
-    consume(KEYWORD, "function");
+    PROFILE_RULE(PROF_FUNCTION_DEC, tokens);
+    int start = tokens.position();
+    consume(KEYWORD, KW_FUNCTION);
 
     inDeclaration = true;
     STNode* name = Id();
     inDeclaration = false;
-    string funcName = name->getData().value;
-    addToCurrentScope(funcName, "func");
+    string_view funcName = name->getData().value;
+    bool declared = bodyMode != BODY_ONLY && addToCurrentScope(name, SYM_FUNC);
+    int visibleGlobals = symbols.bindingMark();
 
     STNode* params = nullptr;
-    if (match(SEP, "(")) {
-        consume(SEP, "(");
+    if (match(SEP, SEP_LPAREN)) {
+        consume(SEP, SEP_LPAREN);
         enterScope();
-        if (!match(SEP, ")")) {
+        if (!match(SEP, SEP_RPAREN)) {
             params = ParamList();
         }
-        consume(SEP, ")");
+        consume(SEP, SEP_RPAREN);
     }
     else {
         enterScope();
     }
 
-    consume(SEP, ":");
+    consume(SEP, SEP_COLON);
     STNode* returnType = Type();
-    consume(SEP, ";");
+    consume(SEP, SEP_SEMICOLON);
+    if (failed) resyncFunctionHeader();
+    int bodyStart = tokens.position();
+
+    if (bodyMode == BODIES_DEFERRED) {
+        skipFunctionBody();
+        exitScope();
+
+        STNode* funcNode = createNode("FUNCTION", "");
+        if (declared) symbols.setParamCount(funcName, countParams(params));
+        deferred.push_back(DeferredBody{ start, bodyStart, tokens.position(), funcNode, visibleGlobals });
+        return funcNode;
+    }
 
     STNode* localDecls = nullptr;
-    while (match(KEYWORD, "var") || match(KEYWORD, "const")) {
-        if (match(KEYWORD, "var")) {
+    while (match(KEYWORD, KW_VAR) || match(KEYWORD, KW_CONST)) {
+        if (match(KEYWORD, KW_VAR)) {
             localDecls = makeSeq(localDecls, VarDec());
         }
-        else if (match(KEYWORD, "const")) {
+        else if (match(KEYWORD, KW_CONST)) {
             localDecls = makeSeq(localDecls, ConstDec());
         }
     }
@@ -385,91 +594,114 @@ STNode* Parser::FunctionDec() {
 
     STNode* rightPart = nullptr;
     if (params) {
-        STNode* typeAndBody = makeSeq(cloneNode(returnType), fullBody);
+        STNode* typeAndBody = makeSeq(returnType, fullBody);
         rightPart = makeSeq(params, typeAndBody);
-        int paramCount = countParams(params);
-        funcTable->addFunction(funcName, paramCount);
     }
     else {
-        rightPart = makeSeq(cloneNode(returnType), fullBody);
-        funcTable->addFunction(funcName, 0);
+        rightPart = makeSeq(returnType, fullBody);
     }
     funcNode->setRight(rightPart);
 
+    // A body parser's function lives in the frozen global table.
+    if (declared) {
+        symbols.setParamCount(funcName, countParams(params));
+    }
     return funcNode;
 }
 
+// Steps over local declarations and the body's begin ... end [;] by
+// keyword nesting alone. Where a valid body ends this is exactly where
+// CompoundState stops; anything else is caught when the body is parsed.
+void Parser::skipFunctionBody() {
+    PROFILE_RULE(PROF_SKIP_BODY, tokens);
+    if (failed) return;
+    while (!tokens.atEnd() && !match(KEYWORD, KW_BEGIN)) {
+        advance();
+    }
+
+    int depth = 0;
+    while (!tokens.atEnd()) {
+        if (match(KEYWORD, KW_BEGIN)) {
+            depth++;
+        }
+        else if (match(KEYWORD, KW_END) && --depth == 0) {
+            advance();
+            if (match(SEP, SEP_SEMICOLON)) advance();
+            return;
+        }
+        advance();
+    }
+    syntaxError(diagnosticHere(DIAG_UNTERMINATED_BODY));
+}
+
 STNode* Parser::ParamList() {
-    STNode* first = Param();
-    if (match(SEP, ";")) {
-        consume(SEP, ";");
-        STNode* rest = ParamList();
-        STNode* seq = createNode("SEQ", "");
-        seq->setLeft(first);
-        seq->setRight(rest);
-        return seq;
+    PROFILE_RULE(PROF_PARAM_LIST, tokens);
+    SeqList params;
+    appendSeq(params, Param());
+    while (match(SEP, SEP_SEMICOLON)) {
+        consume(SEP, SEP_SEMICOLON);
+        appendSeq(params, Param());
     }
-    return first;
+    return params.head;
 }
 
 STNode* Parser::Param() {
+    PROFILE_RULE(PROF_PARAM, tokens);
     bool isVarParam = false;
     bool isConstParam = false;
-    if (match(KEYWORD, "var")) {
-        consume(KEYWORD, "var");
+    if (match(KEYWORD, KW_VAR)) {
+        consume(KEYWORD, KW_VAR);
         isVarParam = true;
     }
-    else if (match(KEYWORD, "const")) {
-        consume(KEYWORD, "const");
+    else if (match(KEYWORD, KW_CONST)) {
+        consume(KEYWORD, KW_CONST);
         isConstParam = true;
     }
+    string_view paramType = isVarParam ? "PARAM_VAR" :
+        isConstParam ? "PARAM_CONST" : "PARAM_VAL";
 
-    const int MAX = 100;
-    STNode* ids[MAX];
-    int count = 0;
+    // The type follows the whole identifier list, so the parameter nodes are
+    // kept aside until it is known.
+    SeqList result;
+    NodeStack params;
     do {
         inDeclaration = true;
         STNode* id = Id();
         inDeclaration = false;
-        addToCurrentScope(id->getData().value, "var");
-        if (count < MAX) {
-            id->setLeft(nullptr);
-            id->setRight(nullptr);
-            ids[count++] = id;
-        }
-    } while (match(SEP, ",") && (consume(SEP, ","), true));
+        if (failed) break;
+        addToCurrentScope(id, SYM_VAR);
 
-    consume(SEP, ":");
+        STNode* paramNode = createNode(paramType, "");
+        paramNode->setLeft(id);
+        appendSeq(result, paramNode);
+        params.push(paramNode);
+    } while (match(SEP, SEP_COMMA) && (consume(SEP, SEP_COMMA), true));
+
+    consume(SEP, SEP_COLON);
     STNode* typeNode = Type();
 
-    STNode* result = nullptr;
-    for (int i = count - 1; i >= 0; i--) {
-        string paramType = isVarParam ? "PARAM_VAR" :
-            isConstParam ? "PARAM_CONST" : "PARAM_VAL";
-        STNode* paramNode = createNode(paramType, "");
-        paramNode->setLeft(cloneNode(ids[i]));
-        paramNode->setRight(cloneNode(typeNode));
-        if (!result) {
-            result = paramNode;
-        }
-        else {
-            result = makeSeq(paramNode, result);
-        }
+    // All parameters of the group share the one TYPE node; nothing modifies
+    // it after parsing but IncrementalParser, which moves it only once, and
+    // the arena frees it exactly once.
+    while (!params.isEmpty()) {
+        params.pop()->setRight(typeNode);
     }
-    return result;
+    return result.head;
 }
 
 STNode* Parser::CompoundState() {
-    consume(KEYWORD, "begin");
+    PROFILE_RULE(PROF_COMPOUND, tokens);
+    consume(KEYWORD, KW_BEGIN);
 
-    if (match(KEYWORD, "var")) {
-        throw runtime_error("Syntax error: variable declarations inside 'begin' block are not allowed");
+    if (match(KEYWORD, KW_VAR)) {
+        semanticError(diagnosticHere(DIAG_VAR_IN_BLOCK));
+        VarDec();
     }
 
     STNode* stmts = parseStmts();
 
-    consume(KEYWORD, "end");
-    if (match(SEP, ";")) consume(SEP, ";");
+    consume(KEYWORD, KW_END);
+    if (match(SEP, SEP_SEMICOLON)) consume(SEP, SEP_SEMICOLON);
 
     STNode* compound = createNode("COMPOUND_STMT", "");
     compound->setLeft(stmts);
@@ -477,11 +709,12 @@ STNode* Parser::CompoundState() {
 }
 
 STNode* Parser::Stmnt() {
-    if (current >= tokens.size()) return nullptr;
-    if (match(KEYWORD, "writeln")) {
+    PROFILE_RULE(PROF_STATEMENT, tokens);
+    if (tokens.atEnd()) return nullptr;
+    if (match(KEYWORD, KW_WRITELN)) {
         return WriteLnStmnt();
     }
-    else if (match(KEYWORD, "begin")) {
+    else if (match(KEYWORD, KW_BEGIN)) {
         return CompoundState();
     }
     else if (match(ID)) {
@@ -491,32 +724,33 @@ STNode* Parser::Stmnt() {
 }
 
 STNode* Parser::AssignOrCall() {
+    PROFILE_RULE(PROF_ASSIGN_OR_CALL, tokens);
     inDeclaration = false;
     STNode* identifier = Id();
-    string idName = identifier->getData().value;
+    string_view idName = identifier->getData().value;
 
-    if (match(SEP, ":=")) {
-        string kind = getIdentifierKind(idName);
-        if (kind == "const") {
-            throw runtime_error("Cannot assign to constant '" + idName + "'");
+    if (match(SEP, SEP_ASSIGN)) {
+        SymbolKind kind = getIdentifierKind(idName);
+        if (kind == SYM_CONST) {
+            semanticError(diagnosticFor(DIAG_CONST_ASSIGN, identifier));
         }
 
-        consume(SEP, ":=");
+        STNode* assignNode = createTokenNode("ASSIGN");
+        consume(SEP, SEP_ASSIGN);
         STNode* expr = Expression();
-        STNode* assignNode = createNode("ASSIGN", ":=");
         assignNode->setLeft(identifier);
         assignNode->setRight(expr);
         return assignNode;
     }
-    else if (match(SEP, "(")) {
-        consume(SEP, "(");
+    else if (match(SEP, SEP_LPAREN)) {
+        consume(SEP, SEP_LPAREN);
         STNode* args = nullptr;
-        if (!match(SEP, ")")) {
+        if (!match(SEP, SEP_RPAREN)) {
             NodeStack argStack;
             do {
                 STNode* expr = Expression();
                 argStack.push(expr);
-            } while (match(SEP, ",") && (consume(SEP, ","), true));
+            } while (match(SEP, SEP_COMMA) && (consume(SEP, SEP_COMMA), true));
 
             args = nullptr;
             while (!argStack.isEmpty()) {
@@ -527,20 +761,20 @@ STNode* Parser::AssignOrCall() {
                 args = makeSeq(wrapper, args);
             }
         }
-        consume(SEP, ")");
+        consume(SEP, SEP_RPAREN);
 
-        string kind = getIdentifierKind(idName);
-        if (kind == "func") {
-            int expectedCount = funcTable->getParamCount(idName);
+        SymbolKind kind = getIdentifierKind(idName);
+        if (kind == SYM_FUNC) {
+            int expectedCount = symbols.getParamCount(idName);
+            int actualCount = countArguments(args);
             if (expectedCount == -1) {
-                throw runtime_error("Function '" + idName + "' not found in function table");
+                semanticError(diagnosticFor(DIAG_UNKNOWN_FUNCTION, identifier));
             }
-
-            int actualCount = countArguments(args);
-            if (actualCount != expectedCount) {
-                throw runtime_error("Function '" + idName + "' expects " +
-                    to_string(expectedCount) + " arguments, but " +
-                    to_string(actualCount) + " were provided");
+            else if (actualCount != expectedCount) {
+                ParseDiagnostic diagnostic = diagnosticFor(DIAG_ARGUMENT_COUNT, identifier);
+                diagnostic.expectedCount = expectedCount;
+                diagnostic.actualCount = actualCount;
+                semanticError(diagnostic);
             }
         }
 
@@ -550,44 +784,64 @@ STNode* Parser::AssignOrCall() {
         return callNode;
     }
     else {
-        throw runtime_error("Expected ':=' or '(' after identifier");
+        syntaxError(diagnosticHere(DIAG_EXPECTED_ASSIGN_OR_CALL));
+        return identifier;
     }
 }
 
+static bool isLeafArgument(const STNode* node) {
+    string_view type = node->getData().type;
+    return type == "ID" || type == "DECNUM" || type == "HEXNUM";
+}
+
 STNode* Parser::WriteLnStmnt() {
+    PROFILE_RULE(PROF_WRITELN, tokens);
     STNode* writeln = createNode("WRITELN", "");
-    consume(KEYWORD, "writeln");
-    consume(SEP, "(");
+    consume(KEYWORD, KW_WRITELN);
+    consume(SEP, SEP_LPAREN);
+    // The arguments chain through right links. An ID or number has no
+    // children, so its own right link is free; any other argument but the
+    // last goes into a SEQ first, so its right operand is kept.
     STNode* args = nullptr;
-    if (!match(SEP, ")")) {
+    if (!match(SEP, SEP_RPAREN)) {
         args = Expression();
+        STNode* link = nullptr;     // whose right child is lastArg
         STNode* lastArg = args;
-        while (match(SEP, ",")) {
-            consume(SEP, ",");
+        while (match(SEP, SEP_COMMA)) {
+            consume(SEP, SEP_COMMA);
             STNode* nextArg = Expression();
+            if (!isLeafArgument(lastArg)) {
+                STNode* seq = createNode("SEQ", "");
+                seq->setLeft(lastArg);
+                if (link) link->setRight(seq);
+                else args = seq;
+                lastArg = seq;
+            }
             lastArg->setRight(nextArg);
+            link = lastArg;
             lastArg = nextArg;
         }
     }
-    consume(SEP, ")");
-    if (match(SEP, ";")) {
-        consume(SEP, ";");
+    consume(SEP, SEP_RPAREN);
+    if (match(SEP, SEP_SEMICOLON)) {
+        consume(SEP, SEP_SEMICOLON);
     }
     writeln->setRight(args);
     return writeln;
 }
 
 STNode* Parser::Expression() {
+    PROFILE_RULE(PROF_EXPRESSION, tokens);
     return SimpleExpr();
 }
 
 STNode* Parser::SimpleExpr() {
+    PROFILE_RULE(PROF_SIMPLE_EXPR, tokens);
     STNode* left = Term();
-    while (match(SEP, "+") || match(SEP, "-")) {
-        string op = currentToken().value;
+    while (match(SEP, SEP_PLUS) || match(SEP, SEP_MINUS)) {
+        STNode* binOp = createTokenNode("BIN_OP");
         advance();
         STNode* right = Term();
-        STNode* binOp = createNode("BIN_OP", op);
         binOp->setLeft(left);
         binOp->setRight(right);
         left = binOp;
@@ -596,28 +850,29 @@ STNode* Parser::SimpleExpr() {
 }
 
 STNode* Parser::Term() {
+    PROFILE_RULE(PROF_TERM, tokens);
     STNode* left = Factor();
     while (true) {
-        if (match(SEP, "*")) {
-            consume(SEP, "*");
+        if (match(SEP, SEP_STAR)) {
+            STNode* binOp = createTokenNode("BIN_OP");
+            consume(SEP, SEP_STAR);
             STNode* right = Factor();
-            STNode* binOp = createNode("BIN_OP", "*");
             binOp->setLeft(left);
             binOp->setRight(right);
             left = binOp;
         }
-        else if (match(SEP, "/")) {
-            consume(SEP, "/");
+        else if (match(SEP, SEP_SLASH)) {
+            STNode* binOp = createTokenNode("BIN_OP");
+            consume(SEP, SEP_SLASH);
             STNode* right = Factor();
-            STNode* binOp = createNode("BIN_OP", "/");
             binOp->setLeft(left);
             binOp->setRight(right);
             left = binOp;
         }
-        else if (match(KEYWORD, "div")) {
-            consume(KEYWORD, "div");
+        else if (match(KEYWORD, KW_DIV)) {
+            STNode* binOp = createTokenNode("BIN_OP");
+            consume(KEYWORD, KW_DIV);
             STNode* right = Factor();
-            STNode* binOp = createNode("BIN_OP", "div");
             binOp->setLeft(left);
             binOp->setRight(right);
             left = binOp;
@@ -630,25 +885,26 @@ STNode* Parser::Term() {
 }
 
 STNode* Parser::Factor() {
+    PROFILE_RULE(PROF_FACTOR, tokens);
     if (match(ID)) {
         inDeclaration = false;
         STNode* idNode = Id();
 
-        if (match(SEP, "(")) {
-            string idName = idNode->getData().value;
-            string kind = getIdentifierKind(idName);
-            if (kind != "func") {
-                throw runtime_error("Identifier '" + idName + "' is not a function");
+        if (match(SEP, SEP_LPAREN)) {
+            string_view idName = idNode->getData().value;
+            bool isFunction = getIdentifierKind(idName) == SYM_FUNC;
+            if (!isFunction) {
+                semanticError(diagnosticFor(DIAG_NOT_A_FUNCTION, idNode));
             }
 
-            consume(SEP, "(");
+            consume(SEP, SEP_LPAREN);
             STNode* args = nullptr;
-            if (!match(SEP, ")")) {
+            if (!match(SEP, SEP_RPAREN)) {
                 NodeStack argStack;
                 do {
                     STNode* expr = Expression();
                     argStack.push(expr);
-                } while (match(SEP, ",") && (consume(SEP, ","), true));
+                } while (match(SEP, SEP_COMMA) && (consume(SEP, SEP_COMMA), true));
 
                 args = nullptr;
                 while (!argStack.isEmpty()) {
@@ -659,18 +915,21 @@ STNode* Parser::Factor() {
                     args = makeSeq(wrapper, args);
                 }
             }
-            consume(SEP, ")");
-
-            int expectedCount = funcTable->getParamCount(idName);
-            if (expectedCount == -1) {
-                throw runtime_error("Function '" + idName + "' not found in function table");
-            }
+            consume(SEP, SEP_RPAREN);
 
+            int expectedCount = symbols.getParamCount(idName);
             int actualCount = countArguments(args);
-            if (actualCount != expectedCount) {
-                throw runtime_error("Function '" + idName + "' expects " +
-                    to_string(expectedCount) + " arguments, but " +
-                    to_string(actualCount) + " were provided");
+            if (!isFunction) {
+                // Already reported.
+            }
+            else if (expectedCount == -1) {
+                semanticError(diagnosticFor(DIAG_UNKNOWN_FUNCTION, idNode));
+            }
+            else if (actualCount != expectedCount) {
+                ParseDiagnostic diagnostic = diagnosticFor(DIAG_ARGUMENT_COUNT, idNode);
+                diagnostic.expectedCount = expectedCount;
+                diagnostic.actualCount = actualCount;
+                semanticError(diagnostic);
             }
 
             STNode* callNode = createNode("FUNC_CALL", "");
@@ -683,125 +942,113 @@ STNode* Parser::Factor() {
     else if (match(DECNUM) || match(HEXNUM)) {
         return Numbers();
     }
-    else if (match(SEP, "(")) {
-        consume(SEP, "(");
+    else if (match(SEP, SEP_LPAREN)) {
+        consume(SEP, SEP_LPAREN);
         STNode* expr = Expression();
-        consume(SEP, ")");
+        consume(SEP, SEP_RPAREN);
         return expr;
     }
-    throw runtime_error("Expected factor");
+    syntaxError(diagnosticHere(DIAG_EXPECTED_FACTOR));
+    return nullptr;
 }
 
 STNode* Parser::Id() {
-    string idName = currentToken().value;
-    consume(ID);
+    PROFILE_RULE(PROF_ID, tokens);
+    if (!match(ID)) {
+        consume(ID);
+        // A stand-in after the error, so callers need no null checks.
+        return createNode("ID", "");
+    }
+    STNode* idNode = createTokenNode("ID");
+    advance();
 
+    string_view idName = idNode->getData().value;
     if (!inDeclaration && !isDeclaredInScopes(idName)) {
-        throw runtime_error("Undeclared identifier: '" + idName + "'");
+        semanticError(diagnosticFor(DIAG_UNDECLARED, idNode));
     }
 
-    return createNode("ID", idName);
+    return idNode;
 }
 
 STNode* Parser::Type() {
+    PROFILE_RULE(PROF_TYPE, tokens);
     STNode* typeNode = createNode("TYPE", "integer");
-    consume(KEYWORD, "integer");
+    consume(KEYWORD, KW_INTEGER);
     return typeNode;
 }
 
 STNode* Parser::Numbers() {
+    PROFILE_RULE(PROF_NUMBERS, tokens);
     if (match(DECNUM)) {
-        STNode* numNode = createNode("DECNUM", currentToken().value);
+        STNode* numNode = createTokenNode("DECNUM");
         consume(DECNUM);
         return numNode;
     }
     else if (match(HEXNUM)) {
-        STNode* numNode = createNode("HEXNUM", currentToken().value);
+        STNode* numNode = createTokenNode("HEXNUM");
         consume(HEXNUM);
         return numNode;
     }
-    throw runtime_error("Expected number");
+    syntaxError(diagnosticHere(DIAG_EXPECTED_NUMBER));
+    return nullptr;
 }
 
 STNode* Parser::parseDecls() {
-    const int MAX_DECLS = 200;
-    STNode* decls[MAX_DECLS];
-    int count = 0;
-
-    auto addDecl = [&](STNode* node) {
-        if (!node || count >= MAX_DECLS) return;
-
-        NodeStack stack;
-        stack.push(node);
-
-        while (!stack.isEmpty() && count < MAX_DECLS) {
-            STNode* current = stack.pop();
-            if (!current) continue;
-
-            if (current->getData().type == "SEQ") {
-                if (current->getRight()) stack.push(current->getRight());
-                if (current->getLeft()) stack.push(current->getLeft());
-            }
-            else {
-                decls[count++] = current;
-            }
-        }
-        };
+    PROFILE_RULE(PROF_DECLARATIONS, tokens);
+    // Every CONST_DECL, VAR_DECL and FUNCTION goes straight onto one flat
+    // SEQ list, in source order.
+    SeqList decls;
 
-    while (match(KEYWORD, "const") || match(KEYWORD, "var") || match(KEYWORD, "function")) {
-        STNode* decl = nullptr;
-        if (match(KEYWORD, "const")) {
-            decl = ConstDec();
-        }
-        else if (match(KEYWORD, "var")) {
-            decl = VarDec();
-        }
-        else if (match(KEYWORD, "function")) {
-            decl = FunctionDec();
+    while (true) {
+        if (failed) resyncDeclaration();
+        if (match(KEYWORD, KW_CONST)) {
+            ConstDec(&decls);
         }
-        if (decl) {
-            addDecl(decl);
+        else if (match(KEYWORD, KW_VAR)) {
+            VarDec(&decls);
         }
-    }
-
-    STNode* result = nullptr;
-    for (int i = count - 1; i >= 0; i--) {
-        if (!result) {
-            result = decls[i];
+        else if (match(KEYWORD, KW_FUNCTION)) {
+            appendSeq(decls, FunctionDec());
         }
         else {
-            result = makeSeq(decls[i], result);
+            break;
         }
     }
 
-    return result;
+    return decls.head;
 }
 
 STNode* Parser::parseStmts() {
-    if (match(KEYWORD, "end") || match(SEP, ".")) {
-        return nullptr;
-    }
-    if (match(SEP, ";")) {
-        advance();
-        return parseStmts();
-    }
+    PROFILE_RULE(PROF_STATEMENTS, tokens);
+    // Only the main block's own statements, not those of nested blocks.
+    bool record = recordStatements;
+    recordStatements = false;
 
-    STNode* currentStmt = Stmnt();
-    if (!currentStmt) {
-        return nullptr;
-    }
+    SeqList stmts;
+    while (true) {
+        if (failed) resyncStatement();
+        if (match(KEYWORD, KW_END) || match(SEP, SEP_DOT)) break;
+        if (match(SEP, SEP_SEMICOLON)) {
+            advance();
+            continue;
+        }
 
-    if (match(SEP, ";")) {
-        advance();
-    }
+        int start = tokens.position();
+        STNode* currentStmt = Stmnt();
+        if (!currentStmt) {
+            // The block's own 'end' reports what stopped it. A recovering
+            // parser reports the same here, then skips the statement and
+            // goes on.
+            if (!recovering || tokens.atEnd() || isDeclarationKeyword(tokens.peek())) break;
+            consume(KEYWORD, KW_END);
+            continue;
+        }
 
-    STNode* rest = parseStmts();
-    if (!rest) {
-        return currentStmt;
+        if (match(SEP, SEP_SEMICOLON)) {
+            advance();
+        }
+        appendSeq(stmts, currentStmt);
+        if (record) mainStatements.push_back(StatementRange{ start, tokens.position() });
     }
-
-    STNode* seq = createNode("SEQ", "");
-    seq->setLeft(currentStmt);
-    seq->setRight(rest);
-    return seq;
+    return stmts.head;
 }
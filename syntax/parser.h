@@ -1,9 +1,15 @@
 #pragma once
+#include "diagnostic.h"
+#include "interner.h"
 #include "stnode.h"
 #include "token.h"
+#include "tokenstream.h"
+#include "symtable.h"
 #include <iostream>
+#include <memory>
 #include <string>
 #include <stdexcept>
+#include <vector>
 
 using namespace std;
 
@@ -15,149 +21,126 @@ extern const int KEYWORD;
 
 class Parser {
 private:
-    struct Scope {
-        string* names;
-        string* kinds;
-        int count;
-        int capacity;
-
-        Scope() {
-            capacity = 4;
-            names = new string[capacity];
-            kinds = new string[capacity];
-            count = 0;
-            for (int i = 0; i < capacity; i++) {
-                names[i] = "";
-                kinds[i] = "";
-            }
-        }
-
-        ~Scope() {
-            delete[] names;
-            delete[] kinds;
-        }
-
-        void add(const string& name, const string& kind) {
-            for (int i = 0; i < count; ++i) {
-                if (names[i] == name) {
-                    throw runtime_error("Identifier '" + name + "' already declared");
-                }
-            }
-
-            if (count >= capacity) {
-                int newCap = capacity * 2;
-                string* newNames = new string[newCap];
-                string* newKinds = new string[newCap];
-
-                for (int i = 0; i < count; ++i) {
-                    newNames[i] = names[i];
-                    newKinds[i] = kinds[i];
-                }
-
-                delete[] names;
-                delete[] kinds;
-                names = newNames;
-                kinds = newKinds;
-                capacity = newCap;
-            }
-
-            names[count] = name;
-            kinds[count] = kind;
-            count++;
-        }
-
-        string getKind(const string& name) const {
-            for (int i = 0; i < count; ++i) {
-                if (names[i] == name) {
-                    return kinds[i];
-                }
-            }
-            return "";
-        }
-
-        bool contains(const string& name) const {
-            return !getKind(name).empty();
-        }
+    // Right-leaning SEQ chain (a (b (c d))) built front to back; tail is the
+    // last SEQ node, whose right child is the most recent item.
+    struct SeqList {
+        STNode* head;
+        STNode* tail;
+
+        SeqList() : head(nullptr), tail(nullptr) {}
     };
 
-    struct FunctionSignature {
-        string name;
-        int paramCount;
-        FunctionSignature* next;
+    // How FunctionDec treats function bodies: parse them in place, skip
+    // them and leave a FUNCTION node to fill in later (parseParallel phase
+    // one), or parse the one function of a body parser (phase two).
+    enum BodyMode {
+        BODIES_INLINE,
+        BODIES_DEFERRED,
+        BODY_ONLY
+    };
 
-        FunctionSignature(const string& n, int count) : name(n), paramCount(count), next(nullptr) {}
+    // A function whose body was skipped in phase one: tokens [start, end)
+    // and the FUNCTION node that receives its children.
+    struct DeferredBody {
+        int start;
+        int bodyStart;          // first token after the header
+        int end;
+        STNode* funcNode;
+        int visibleGlobals;     // SymbolTable::bindingMark() after its name
     };
 
-    class FunctionTable {
-    private:
-        FunctionSignature* head;
-
-    public:
-        FunctionTable() : head(nullptr) {}
-
-        ~FunctionTable() {
-            FunctionSignature* current = head;
-            while (current) {
-                FunctionSignature* next = current->next;
-                delete current;
-                current = next;
-            }
-        }
-
-        void addFunction(const string& name, int paramCount) {
-            FunctionSignature* current = head;
-            while (current) {
-                if (current->name == name) {
-                    throw runtime_error("Function '" + name + "' already declared");
-                }
-                current = current->next;
-            }
-
-            FunctionSignature* newFunc = new FunctionSignature(name, paramCount);
-            newFunc->next = head;
-            head = newFunc;
-        }
-
-        int getParamCount(const string& name) const {
-            FunctionSignature* current = head;
-            while (current) {
-                if (current->name == name) {
-                    return current->paramCount;
-                }
-                current = current->next;
-            }
-            return -1;
-        }
+    // Tokens [start, end) of one top-level statement of the main block,
+    // including the ';' after it.
+    struct StatementRange {
+        int start;
+        int end;
     };
 
-    const TokenArray& tokens;
-    int current;
+    friend class IncrementalParser;
+
+    const TokenArray* tokenArray;   // null when reading from a TokenStream
+    ArrayTokenStream arrayTokens;   // used by the TokenArray constructors
+    TokenStream& tokens;
     BinTree* stTree;
+    SharedInterner* strings;        // null: node text goes into stTree's arena
+    unique_ptr<InternCache> stringCache;
 
-    Scope** scopes;
-    int scopeCount;
-    int scopeCapacity;
+    SymbolTable symbols;
     bool inDeclaration;
-    FunctionTable* funcTable;
+    bool verbose;
+
+    BodyMode bodyMode;
+    vector<DeferredBody> deferred;
+    // Also noted in phase one; both stay valid after a split parse.
+    vector<StatementRange> mainStatements;
+    STNode* mainBlockParent;    // its right child is the main block's chain
+    bool recordStatements;
+    bool splitParse;            // the last parseParallel kept phase one's tree
+
+    // Errors are recorded, never thrown from inside the rules. After the
+    // first one failed stays set, so match() fails, consume() does nothing
+    // and every rule unwinds on its own. parseWithRecovery sets recovering:
+    // there only syntax errors set failed, and a rule that owns a resync
+    // point clears it after skipping ahead.
+    bool recovering;
+    bool failed;
+    vector<ParseDiagnostic> diagnostics;
+
+    // Body parser for parseParallel: reads the function starting at
+    // tokens[start], seeing the globals of phase one up to visibleGlobals.
+    // Without insideFunction it reads a statement of the main block, where
+    // every global is visible and complete.
+    Parser(const TokenArray& tokens, int start, const SymbolTable& globals, int visibleGlobals,
+        bool insideFunction = true);
 
-    Token currentToken() const;
     void advance();
-    bool match(int expectedTypeCode, const string& expectedValue = "") const;
-    void consume(int expectedTypeCode, const string& expectedValue = "");
-
-    STNode* createNode(const string& type, const string& value = "", int line = -1);
+    bool match(int expectedTypeCode, int expectedLexeme = LX_NONE) const;
+    void consume(int expectedTypeCode, int expectedLexeme = LX_NONE);
+
+    // A syntax error leaves the token stream out of step and always sets
+    // failed; a semantic one does only outside recovery. Nothing is
+    // recorded while failed is set.
+    void syntaxError(const ParseDiagnostic& diagnostic);
+    void semanticError(const ParseDiagnostic& diagnostic);
+    // Records at the current token, and naming the identifier id.
+    ParseDiagnostic diagnosticHere(DiagnosticCode code) const;
+    static ParseDiagnostic diagnosticFor(DiagnosticCode code, const STNode* id);
+    int currentLine() const;
+
+    // Panic mode ends here: past the next ';' or before 'end', '.' or a
+    // declaration keyword; before the next declaration keyword or 'begin';
+    // past the next ';' or before a keyword other than 'integer' inside a
+    // const or var block; before the first local declaration or 'begin'
+    // after a function header. Outside recovery they leave failed set.
+    void resyncStatement();
+    void resyncDeclaration();
+    void resyncDeclarationItem();
+    void resyncFunctionHeader();
+
+    // Node text as stored for the tree: a copy in its arena, or the
+    // interned one.
+    string_view storeText(string_view text);
+    STNode* createNode(string_view type, string_view value = "", int line = -1);
+    // Node for the current token, made before it is consumed.
+    STNode* createTokenNode(string_view type);
     STNode* makeSeq(STNode* left, STNode* right);
+    void appendSeq(SeqList& list, STNode* item);
 
     void enterScope();
     void exitScope();
-    void addToCurrentScope(const string& name, const string& kind);
-    string getIdentifierKind(const string& name) const;
-    bool isDeclaredInScopes(const string& name) const;
+    // False, after reporting it, when id's name is already declared in the
+    // scope.
+    bool addToCurrentScope(const STNode* id, SymbolKind kind);
+    SymbolKind getIdentifierKind(string_view name) const;
+    bool isDeclaredInScopes(string_view name) const;
 
     STNode* Program();
-    STNode* ConstDec();
-    STNode* VarDec();
+    // With decls, each declaration is appended to that list as it is parsed;
+    // otherwise the block is returned as its own SEQ subtree.
+    STNode* ConstDec(SeqList* decls = nullptr);
+    STNode* VarDec(SeqList* decls = nullptr);
     STNode* FunctionDec();
+    void skipFunctionBody();
     STNode* ParamList();
     STNode* Param();
     STNode* CompoundState();
@@ -175,17 +158,51 @@ private:
     STNode* parseStmts();
     STNode* parseMainBlock();
 
+    // Run on the subtree just built, while parsing; FlatTree is made from
+    // a finished tree and has its own copies of both for walks after that.
     int countParams(STNode* paramsNode);
     int countArguments(STNode* argsNode);
 
 public:
     Parser(const TokenArray& tokens);
+    // Reads tokens strictly in order and never goes back, so a TokenPipeline
+    // can feed it while the input is still being read.
+    Parser(TokenStream& tokens);
     ~Parser();
 
     Parser(const Parser&) = delete;
     Parser& operator=(const Parser&) = delete;
 
+    // Status messages on cout are on by default; batch runs turn them off.
+    void setVerbose(bool on) { verbose = on; }
+
+    // Takes node text from pool instead of copying it into the tree, so
+    // every spelling is stored once for all the trees built with pool,
+    // from any thread, and equal values share one pointer. pool must
+    // outlive the trees. Set before parsing.
+    void setInterner(SharedInterner* pool);
+
+    // Throws runtime_error("Parsing failed: ...") with the first error.
     void parse();
+    // The same without throwing: returns false and leaves that error as the
+    // one entry of getDiagnostics(), with the partial tree kept for it.
+    bool tryParse();
+
+    // Reads the whole input even past errors: after each syntax error the
+    // parser skips to the next ';', 'end' or declaration keyword and goes
+    // on, so one pass finds every error. Returns true when there were
+    // none; the tree, partial after errors, is kept either way.
+    bool parseWithRecovery();
+    const vector<ParseDiagnostic>& getDiagnostics() const { return diagnostics; }
+
+    // Same tree and errors as parse(), with function bodies parsed in
+    // parallel: phase one parses everything else and the function headers,
+    // phase two parses each body on a WorkStealingPool against the global
+    // symbols visible at that function. threads <= 0 uses every hardware
+    // thread. Needs the TokenArray constructor; on any error it reparses
+    // sequentially so the reported error is exactly parse()'s.
+    void parseParallel(int threads = 0);
+
     BinTree* getST();
 
     void print() const;
@@ -1,8 +1,86 @@
 #include "stnode.h"
+#include <cstring>
+#include <vector>
 
-STNode::~STNode() {
-    delete left;
-    delete right;
+static const size_t ARENA_FIRST_CHUNK = 64 * 1024;
+static const size_t ARENA_MAX_CHUNK = 4 * 1024 * 1024;
+
+NodeArena::NodeArena()
+    : head(nullptr), cursor(nullptr), limit(nullptr), nextChunkSize(ARENA_FIRST_CHUNK), used(0), nodes(0) {
+}
+
+NodeArena::~NodeArena() {
+    clear();
+}
+
+void* NodeArena::allocateSlow(size_t size, size_t align) {
+    size_t capacity = nextChunkSize;
+    if (capacity < size + align) {
+        capacity = size + align;
+    }
+    else if (nextChunkSize < ARENA_MAX_CHUNK) {
+        nextChunkSize *= 2;
+    }
+
+    Chunk* chunk = (Chunk*)::operator new(sizeof(Chunk) + capacity);
+    chunk->next = head;
+    chunk->capacity = capacity;
+    head = chunk;
+    cursor = (char*)(chunk + 1);
+    limit = cursor + capacity;
+
+    char* p = (char*)(((size_t)cursor + align - 1) & ~(align - 1));
+    cursor = p + size;
+    used += size;
+    return p;
+}
+
+string_view NodeArena::storeText(string_view text) {
+    if (text.empty()) return string_view();
+    char* p = (char*)allocate(text.size(), 1);
+    memcpy(p, text.data(), text.size());
+    return string_view(p, text.size());
+}
+
+void NodeArena::clear() {
+    while (head) {
+        Chunk* next = head->next;
+        ::operator delete(head);
+        head = next;
+    }
+    cursor = nullptr;
+    limit = nullptr;
+    nextChunkSize = ARENA_FIRST_CHUNK;
+    used = 0;
+    nodes = 0;
+}
+
+void NodeArena::adopt(NodeArena& other) {
+    if (!other.head) return;
+
+    if (!head) {
+        head = other.head;
+        cursor = other.cursor;
+        limit = other.limit;
+        nextChunkSize = other.nextChunkSize;
+    }
+    else {
+        // Keep allocating from our own current chunk; the adopted ones are
+        // only kept alive.
+        Chunk* last = other.head;
+        while (last->next) last = last->next;
+        last->next = head->next;
+        head->next = other.head;
+    }
+    used += other.used;
+    nodes += other.nodes;
+
+    other.head = nullptr;
+    other.cursor = nullptr;
+    other.limit = nullptr;
+    other.nextChunkSize = ARENA_FIRST_CHUNK;
+    other.used = 0;
+    other.nodes = 0;
 }
 
 NodeStack::NodeStack() : data(nullptr), capacity(10), top(-1) {
@@ -80,46 +158,102 @@ void NodeStack::clear() {
     top = -1;
 }
 
-BinTree::BinTree() : root(nullptr) {}
+BinTree::BinTree() : root(nullptr), shared(false) {}
 
-BinTree::~BinTree() {
-    delete root;
-}
+BinTree::~BinTree() {}
 
-void BinTree::printBinaryTree(STNode* node, int depth, ostream& out) const {
+void BinTree::printBinaryTree(STNode* node, int depth, TextWriter& out) const {
     if (!node) return;
-    out << string(depth * 2, ' ') << node->getData().toString() << '\n';
-    printBinaryTree(node->getLeft(), depth + 1, out);
-    printBinaryTree(node->getRight(), depth + 1, out);
+
+    // Explicit stack instead of recursion: SEQ chains are as deep as the
+    // program is long.
+    struct Pending {
+        STNode* node;
+        int depth;
+    };
+    vector<Pending> stack;
+    stack.push_back({ node, depth });
+
+    while (!stack.empty()) {
+        Pending item = stack.back();
+        stack.pop_back();
+
+        const STData& data = item.node->getData();
+        out.indent(item.depth * 2);
+        out.label(data.type, data.value);
+        out.put('\n');
+
+        if (item.node->getRight()) stack.push_back({ item.node->getRight(), item.depth + 1 });
+        if (item.node->getLeft()) stack.push_back({ item.node->getLeft(), item.depth + 1 });
+    }
 }
 
-void BinTree::writeNode(STNode* node, ofstream& file) const {
+void BinTree::writeNode(STNode* node, TextWriter& out) const {
     if (!node) {
         return;
     }
 
-    file << "(" << node->getData().toString();
+    // A node is pushed once to open it and once more, as a marker, to
+    // close it after both subtrees have been written.
+    NodeStack nodes;
+    NodeStack closing;
+    nodes.push(node);
 
-    STNode* left = node->getLeft();
-    STNode* right = node->getRight();
+    while (!nodes.isEmpty()) {
+        STNode* current = nodes.pop();
+        if (current == closing.peek()) {
+            closing.pop();
+            out.put(')');
+            continue;
+        }
 
-    if (left) {
-        writeNode(left, file);
+        const STData& data = current->getData();
+        out.put('(');
+        out.label(data.type, data.value);
+        nodes.push(current);
+        closing.push(current);
+
+        STNode* left = current->getLeft();
+        STNode* right = current->getRight();
+        if (right) {
+            nodes.push(right);
+        }
+        if (left) {
+            nodes.push(left);
+        }
     }
+}
+
+void BinTree::printST() const {
+    printST(cout);
+}
 
-    if (right) {
-        writeNode(right, file);
+void BinTree::printST(ostream& out) const {
+    TextWriter writer(out);
+    printST(writer);
+}
+
+void BinTree::printST(TextWriter& out) const {
+    if (root) {
+        printBinaryTree(root, 0, out);
     }
+    else {
+        out.put("(empty tree)\n");
+    }
+}
 
-    file << ")";
+void BinTree::write(ostream& out) const {
+    TextWriter writer(out);
+    write(writer);
 }
 
-void BinTree::printST() const {
+void BinTree::write(TextWriter& out) const {
     if (root) {
-        printBinaryTree(root, 0, cout);
+        writeNode(root, out);
+        out.put('\n');
     }
     else {
-        cout << "(empty tree)" << endl;
+        out.put("(empty)\n");
     }
 }
 
@@ -128,12 +262,6 @@ void BinTree::saveToFile(const string& filename) const {
     if (!file.is_open()) {
         throw runtime_error("Cannot open file: " + filename);
     }
-    if (root) {
-        writeNode(root, file);
-        file << endl;
-    }
-    else {
-        file << "(empty)" << endl;
-    }
+    write(file);
     file.close();
 }
@@ -1,24 +1,69 @@
 #pragma once
+#include "textwriter.h"
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <fstream>
+#include <cstddef>
+#include <new>
 
 using namespace std;
 
+enum NodeKind : unsigned char {
+    NODE_PROGRAM,
+    NODE_SEQ,
+    NODE_CONST_DECL,
+    NODE_VAR_DECL,
+    NODE_TYPE,
+    NODE_FUNCTION,
+    NODE_PARAM_VAL,
+    NODE_PARAM_VAR,
+    NODE_PARAM_CONST,
+    NODE_COMPOUND_STMT,
+    NODE_ASSIGN,
+    NODE_FUNC_CALL,
+    NODE_WRITELN,
+    NODE_BIN_OP,
+    NODE_ID,
+    NODE_DECNUM,
+    NODE_HEXNUM,
+    NODE_UNKNOWN
+};
+
+inline string_view nodeKindName(int kind) {
+    static const string_view names[NODE_UNKNOWN] = {
+        "PROGRAM", "SEQ", "CONST_DECL", "VAR_DECL", "TYPE", "FUNCTION",
+        "PARAM_VAL", "PARAM_VAR", "PARAM_CONST", "COMPOUND_STMT", "ASSIGN",
+        "FUNC_CALL", "WRITELN", "BIN_OP", "ID", "DECNUM", "HEXNUM"
+    };
+    return (kind >= 0 && kind < NODE_UNKNOWN) ? names[kind] : "";
+}
+
+inline int nodeKindOf(string_view type) {
+    for (int i = 0; i < NODE_UNKNOWN; i++) {
+        if (nodeKindName(i) == type) return i;
+    }
+    return NODE_UNKNOWN;
+}
+
+// type is always a string literal; value points into the owning tree's
+// NodeArena (or a literal), so STData is trivially destructible. token is
+// the index of the token value was taken from, or -1 for synthesized nodes.
 struct STData {
-    string type;
-    string value;
+    string_view type;
+    string_view value;
     int line;
+    int token;
 
-    STData(const string& t = "", const string& v = "", int l = 0)
-        : type(t), value(v), line(l) {
+    STData(string_view t = "", string_view v = "", int l = 0, int tok = -1)
+        : type(t), value(v), line(l), token(tok) {
     }
 
     string toString() const {
         if (value.empty() || value == type) {
-            return type;
+            return string(type);
         }
-        return type + ":" + value;
+        return string(type) + ":" + string(value);
     }
 };
 
@@ -30,7 +75,6 @@ private:
 
 public:
     STNode(const STData& value) : data(value), left(nullptr), right(nullptr) {}
-    ~STNode();
 
     const STData& getData() const { return data; }
     STNode* getLeft() const { return left; }
@@ -38,6 +82,9 @@ public:
 
     void setLeft(STNode* node) { left = node; }
     void setRight(STNode* node) { right = node; }
+
+    // Points the node at the same token after an edit moved it.
+    void moveToToken(int token, int line) { data.token = token; data.line = line; }
 };
 
 class NodeStack {
@@ -60,21 +107,94 @@ public:
     void clear();
 };
 
+// Bump allocator that owns every node and node string of one BinTree.
+// Nodes are never freed one by one: the arena drops all of its chunks at
+// once, so teardown cost does not depend on the shape of the tree.
+class NodeArena {
+private:
+    struct Chunk {
+        Chunk* next;
+        size_t capacity;
+    };
+
+    Chunk* head;
+    char* cursor;
+    char* limit;
+    size_t nextChunkSize;
+    size_t used;
+    size_t nodes;
+
+    void* allocateSlow(size_t size, size_t align);
+
+public:
+    NodeArena();
+    ~NodeArena();
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void* allocate(size_t size, size_t align) {
+        char* p = (char*)(((size_t)cursor + align - 1) & ~(align - 1));
+        if (!cursor || p + size > limit) {
+            return allocateSlow(size, align);
+        }
+        cursor = p + size;
+        used += size;
+        return p;
+    }
+
+    STNode* newNode(const STData& data) {
+        nodes++;
+        return new (allocate(sizeof(STNode), alignof(STNode))) STNode(data);
+    }
+
+    string_view storeText(string_view text);
+    void clear();
+
+    // Takes over every chunk of other, which is left empty. Nodes and text
+    // keep their addresses, so subtrees built in other stay valid here.
+    void adopt(NodeArena& other);
+
+    size_t bytesUsed() const { return used; }
+    size_t nodesAllocated() const { return nodes; }
+};
+
 class BinTree {
 private:
     STNode* root;
+    NodeArena arena;
+    bool shared;
 
-    void printBinaryTree(STNode* node, int depth, ostream& out) const;
-    void writeNode(STNode* node, ofstream& file) const;
+    void printBinaryTree(STNode* node, int depth, TextWriter& out) const;
+    void writeNode(STNode* node, TextWriter& out) const;
 
 public:
     BinTree();
     ~BinTree();
 
+    BinTree(const BinTree&) = delete;
+    BinTree& operator=(const BinTree&) = delete;
+
+    STNode* newNode(const STData& data) { return arena.newNode(data); }
+    string_view storeText(string_view text) { return arena.storeText(text); }
+    NodeArena& getArena() { return arena; }
+
     void setRoot(STNode* node) { root = node; }
     STNode* getRoot() const { return root; }
     bool isEmpty() const { return root == nullptr; }
 
+    // Set by hashConsTree: nodes may have several parents, so the tree is
+    // a DAG that reads like the tree it stands for but must not be
+    // modified. Walks that count or print nodes see every occurrence.
+    void markShared() { shared = true; }
+    bool isShared() const { return shared; }
+
+    // Indented listing and parenthesized form. The TextWriter overloads
+    // append to a caller's buffer, which may be a string in memory.
     void printST() const;
+    void printST(ostream& out) const;
+    void printST(TextWriter& out) const;
+    void write(ostream& out) const;
+    void write(TextWriter& out) const;
     void saveToFile(const string& filename) const;
 };
@@ -0,0 +1,200 @@
+#include "symtable.h"
+#include "parseprofile.h"
+
+SymbolTable::SymbolTable()
+    : keys(nullptr), keyCount(0), keyCapacity(0),
+    slots(nullptr), slotCount(0),
+    bindings(nullptr), bindingCount(0), bindingCapacity(0),
+    scopeStarts(nullptr), depth(0), scopeCapacity(4),
+    outer(nullptr), outerVisible(0), outerOpen(false) {
+    keyCapacity = 16;
+    keys = new Key[keyCapacity];
+
+    slotCount = 32;
+    slots = new int[slotCount];
+    for (int i = 0; i < slotCount; i++) slots[i] = -1;
+
+    bindingCapacity = 16;
+    bindings = new Binding[bindingCapacity];
+
+    scopeStarts = new int[scopeCapacity];
+    scopeStarts[0] = 0;
+}
+
+SymbolTable::~SymbolTable() {
+    delete[] keys;
+    delete[] slots;
+    delete[] bindings;
+    delete[] scopeStarts;
+}
+
+unsigned int SymbolTable::hashName(string_view name) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < name.size(); i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int SymbolTable::findKey(string_view name, unsigned int hash) const {
+    unsigned int mask = (unsigned int)slotCount - 1;
+    for (unsigned int i = hash & mask;; i = (i + 1) & mask) {
+        int key = slots[i];
+        if (key < 0) return -1;
+        if (keys[key].hash == hash && keys[key].name == name) return key;
+    }
+}
+
+void SymbolTable::growSlots() {
+    int newCount = slotCount * 2;
+    int* newSlots = new int[newCount];
+    for (int i = 0; i < newCount; i++) newSlots[i] = -1;
+
+    unsigned int mask = (unsigned int)newCount - 1;
+    for (int key = 0; key < keyCount; key++) {
+        unsigned int i = keys[key].hash & mask;
+        while (newSlots[i] >= 0) i = (i + 1) & mask;
+        newSlots[i] = key;
+    }
+
+    delete[] slots;
+    slots = newSlots;
+    slotCount = newCount;
+}
+
+int SymbolTable::internKey(string_view name) {
+    unsigned int hash = hashName(name);
+    int key = findKey(name, hash);
+    if (key >= 0) return key;
+
+    if ((keyCount + 1) * 2 > slotCount) {
+        growSlots();
+    }
+    if (keyCount >= keyCapacity) {
+        int newCap = keyCapacity * 2;
+        Key* newKeys = new Key[newCap];
+        for (int i = 0; i < keyCount; i++) newKeys[i] = keys[i];
+        delete[] keys;
+        keys = newKeys;
+        keyCapacity = newCap;
+    }
+
+    key = keyCount++;
+    keys[key].name = names.storeText(name);
+    keys[key].hash = hash;
+    keys[key].top = -1;
+
+    unsigned int mask = (unsigned int)slotCount - 1;
+    unsigned int i = hash & mask;
+    while (slots[i] >= 0) i = (i + 1) & mask;
+    slots[i] = key;
+    return key;
+}
+
+const SymbolTable::Binding* SymbolTable::lookupOwn(string_view name, unsigned int hash) const {
+    int key = findKey(name, hash);
+    if (key < 0 || keys[key].top < 0) return nullptr;
+    return &bindings[keys[key].top];
+}
+
+const SymbolTable::Binding* SymbolTable::lookup(string_view name, bool& inherited) const {
+    unsigned int hash = hashName(name);
+    inherited = false;
+    const Binding* binding = lookupOwn(name, hash);
+    if (binding || !outer) return binding;
+
+    // The outer table is frozen at depth 0, so its only binding of a name
+    // is the global one, and its index says where it was declared.
+    binding = outer->lookupOwn(name, hash);
+    if (!binding || binding - outer->bindings >= outerVisible) return nullptr;
+    inherited = true;
+    return binding;
+}
+
+void SymbolTable::setOuter(const SymbolTable* table, int visibleBindings, bool insideFunction) {
+    outer = table;
+    outerVisible = visibleBindings;
+    outerOpen = insideFunction;
+}
+
+void SymbolTable::enterScope() {
+    PROFILE_SYMBOL(PROF_SYM_ENTER_SCOPE);
+    if (depth + 1 >= scopeCapacity) {
+        int newCap = scopeCapacity * 2;
+        int* newStarts = new int[newCap];
+        for (int i = 0; i <= depth; i++) newStarts[i] = scopeStarts[i];
+        delete[] scopeStarts;
+        scopeStarts = newStarts;
+        scopeCapacity = newCap;
+    }
+    scopeStarts[++depth] = bindingCount;
+}
+
+void SymbolTable::exitScope() {
+    PROFILE_SYMBOL(PROF_SYM_EXIT_SCOPE);
+    if (depth == 0) return;
+    int start = scopeStarts[depth--];
+    while (bindingCount > start) {
+        const Binding& binding = bindings[--bindingCount];
+        keys[binding.key].top = binding.shadowed;
+    }
+}
+
+void SymbolTable::declare(string_view name, SymbolKind kind) {
+    if (!tryDeclare(name, kind)) {
+        throw runtime_error("Identifier '" + string(name) + "' already declared");
+    }
+}
+
+bool SymbolTable::tryDeclare(string_view name, SymbolKind kind) {
+    PROFILE_SYMBOL(PROF_SYM_DECLARE);
+    int key = internKey(name);
+    int top = keys[key].top;
+    if (top >= 0 && bindings[top].depth == depth) {
+        return false;
+    }
+
+    if (bindingCount >= bindingCapacity) {
+        int newCap = bindingCapacity * 2;
+        Binding* newBindings = new Binding[newCap];
+        for (int i = 0; i < bindingCount; i++) newBindings[i] = bindings[i];
+        delete[] bindings;
+        bindings = newBindings;
+        bindingCapacity = newCap;
+    }
+
+    Binding& binding = bindings[bindingCount];
+    binding.key = key;
+    binding.depth = depth;
+    binding.kind = kind;
+    binding.paramCount = -1;
+    binding.shadowed = top;
+    keys[key].top = bindingCount++;
+    return true;
+}
+
+SymbolKind SymbolTable::getKind(string_view name) const {
+    PROFILE_SYMBOL(PROF_SYM_GET_KIND);
+    bool inherited;
+    const Binding* binding = lookup(name, inherited);
+    return binding ? binding->kind : SYM_NONE;
+}
+
+void SymbolTable::setParamCount(string_view name, int paramCount) {
+    PROFILE_SYMBOL(PROF_SYM_SET_PARAMS);
+    const Binding* binding = lookupOwn(name, hashName(name));
+    if (!binding || binding->kind != SYM_FUNC) {
+        throw runtime_error("Function '" + string(name) + "' is not declared");
+    }
+    const_cast<Binding*>(binding)->paramCount = paramCount;
+}
+
+int SymbolTable::getParamCount(string_view name) const {
+    PROFILE_SYMBOL(PROF_SYM_GET_PARAMS);
+    bool inherited;
+    const Binding* binding = lookup(name, inherited);
+    if (!binding || binding->kind != SYM_FUNC) return -1;
+    if (inherited && outerOpen && binding - outer->bindings == outerVisible - 1) return -1;
+    return binding->paramCount;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "stnode.h"
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+using namespace std;
+
+enum SymbolKind : unsigned char {
+    SYM_NONE,
+    SYM_VAR,
+    SYM_CONST,
+    SYM_FUNC
+};
+
+// Scoped symbol table for variables, constants and function signatures.
+//
+// Every distinct name is interned once into an open-addressing hash table
+// and gets a small key id. Each key id points at its innermost visible
+// binding; bindings form a stack and remember the binding they shadow, so
+// lookups are one hash probe and leaving a scope only touches the bindings
+// made in it.
+class SymbolTable {
+private:
+    struct Key {
+        string_view name;
+        unsigned int hash;
+        int top;        // innermost binding of this name, -1 if none
+    };
+
+    struct Binding {
+        int key;
+        int depth;
+        SymbolKind kind;
+        int paramCount; // functions only, -1 until the signature is known
+        int shadowed;   // binding of the same name in an outer scope
+    };
+
+    Key* keys;
+    int keyCount;
+    int keyCapacity;
+
+    int* slots;         // key id per slot, -1 when empty
+    int slotCount;      // power of two
+
+    Binding* bindings;
+    int bindingCount;
+    int bindingCapacity;
+
+    int* scopeStarts;
+    int depth;
+    int scopeCapacity;
+
+    NodeArena names;
+
+    // Read-only enclosing table consulted for names not bound here; only
+    // its first outerVisible bindings exist as far as this table is concerned.
+    const SymbolTable* outer;
+    int outerVisible;
+    bool outerOpen;     // last visible outer binding is the enclosing function
+
+    static unsigned int hashName(string_view name);
+    int findKey(string_view name, unsigned int hash) const;
+    int internKey(string_view name);
+    void growSlots();
+    const Binding* lookupOwn(string_view name, unsigned int hash) const;
+    const Binding* lookup(string_view name, bool& inherited) const;
+
+public:
+    SymbolTable();
+    ~SymbolTable();
+
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    void enterScope();
+    void exitScope();
+    int scopeDepth() const { return depth; }
+
+    // Bindings made so far; global bindings are numbered in declaration
+    // order, so a count taken at depth 0 marks a point in the source.
+    int bindingMark() const { return bindingCount; }
+
+    // Makes the first visibleBindings bindings of a frozen table visible
+    // beneath this one, as the globals were when a function was reached.
+    // With insideFunction the binding just before the mark is that function
+    // itself: its parameter count reads as unknown, as it does while its
+    // body is parsed. table must not change while this one uses it.
+    void setOuter(const SymbolTable* table, int visibleBindings, bool insideFunction = true);
+
+    // Throws if name is already declared in the innermost scope.
+    void declare(string_view name, SymbolKind kind);
+    // Same, but returns false instead of throwing.
+    bool tryDeclare(string_view name, SymbolKind kind);
+
+    SymbolKind getKind(string_view name) const;
+    bool contains(string_view name) const { return getKind(name) != SYM_NONE; }
+
+    void setParamCount(string_view name, int paramCount);
+    int getParamCount(string_view name) const;
+};
@@ -1,11 +1,191 @@
 #include "token.h"
+#include "tokenbin.h"
+#include "treebin.h"
+#include "batch.h"
+#include "fold.h"
+#include "hashcons.h"
+#include "tokenstream.h"
 #include "parser.h" 
+#include "parseprofile.h"
+#include "vm.h"
+#include "native.h"
+#include <fstream>
 #include <iostream>
+#include <string>
 
 using namespace std;
 
-int main() {
+// Reports the parse profile when main returns; a build without
+// SYNTAX_PROFILE has nothing to report.
+struct ProfileReport {
+    string jsonPath;    // empty: a table on cerr
+
+    ~ProfileReport() {
+        if (!profileCompiledIn()) return;
+        if (jsonPath.empty()) {
+            printProfile(cerr);
+            return;
+        }
+        ofstream out(jsonPath);
+        writeProfileJson(out);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // --profile-json <file> may come before any other mode.
+    ProfileReport profile;
+    if (argc > 2 && string(argv[1]) == "--profile-json") {
+        profile.jsonPath = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
     try {
+        if (argc > 1 && string(argv[1]) == "--convert") {
+            if (argc != 4) {
+                cerr << "Usage: " << argv[0] << " --convert <lexer.txt> <tokens.bin>" << endl;
+                return 1;
+            }
+            int count = convertTokenFile(argv[2], argv[3]);
+            cout << "Wrote " << count << " tokens to '" << argv[3] << "'" << endl;
+            return 0;
+        }
+
+        if (argc > 1 && string(argv[1]) == "--save-tree") {
+            if (argc != 4) {
+                cerr << "Usage: " << argv[0] << " --save-tree <lexer.txt | tokens.bin> <tree.bin>" << endl;
+                return 1;
+            }
+            TokenArray tokens = loadTokens(argv[2]);
+            Parser parser(tokens);
+            parser.parse();
+            saveTreeBinary(*parser.getST(), argv[3]);
+            cout << "Wrote the syntax tree to '" << argv[3] << "'" << endl;
+            return 0;
+        }
+
+        if (argc > 1 && string(argv[1]) == "--load-tree") {
+            if (argc < 3 || argc > 4) {
+                cerr << "Usage: " << argv[0] << " --load-tree <tree.bin> [syntax_tree.txt]" << endl;
+                return 1;
+            }
+            BinTree tree;
+            loadTreeBinary(argv[2], tree);
+            tree.saveToFile(argc > 3 ? argv[3] : "syntax_tree.txt");
+            return 0;
+        }
+
+        if (argc > 1 && string(argv[1]) == "--batch") {
+            BatchOptions options;
+            vector<string> inputs;
+            for (int i = 2; i < argc; i++) {
+                string arg = argv[i];
+                if (arg == "-j" && i + 1 < argc) {
+                    options.threads = stoi(argv[++i]);
+                }
+                else if (arg == "-o" && i + 1 < argc) {
+                    options.outputDir = argv[++i];
+                }
+                else if (arg == "--all-errors") {
+                    options.allErrors = true;
+                }
+                else {
+                    inputs.push_back(arg);
+                }
+            }
+            if (inputs.empty()) {
+                cerr << "Usage: " << argv[0] << " --batch [-j threads] [-o outdir] [--all-errors] <file | dir>..." << endl;
+                return 1;
+            }
+            return runBatch(inputs, options);
+        }
+
+        if (argc > 1 && string(argv[1]) == "--stream") {
+            if (argc < 3 || argc > 4) {
+                cerr << "Usage: " << argv[0] << " --stream <lexer.txt | -> [syntax_tree.txt]" << endl;
+                return 1;
+            }
+            string inputName = argv[2];
+            ifstream file;
+            if (inputName != "-") {
+                file.open(inputName, ios::binary);
+                if (!file.is_open()) {
+                    cerr << "Error: Cannot open file: " << inputName << endl;
+                    return 1;
+                }
+            }
+
+            TokenPipeline tokens(inputName == "-" ? cin : file);
+            Parser parser(tokens);
+            parser.parse();
+            parser.saveTreeToFile(argc > 3 ? argv[3] : "syntax_tree.txt");
+            return 0;
+        }
+
+        // --run compiles the folded tree to bytecode and executes it;
+        // --disasm prints the bytecode instead and --asm writes it out as
+        // x86-64 assembly.
+        if (argc > 1 && string(argv[1]) == "--asm") {
+            if (argc > 4) {
+                cerr << "Usage: " << argv[0] << " --asm [lexer.txt | tokens.bin] [program.s]" << endl;
+                return 1;
+            }
+            TokenArray tokens = loadTokens(argc > 2 ? argv[2] : "lexer.txt", false);
+            Parser parser(tokens);
+            parser.setVerbose(false);
+            parser.parse();
+            foldConstants(*parser.getST());
+            Bytecode program = compileProgram(*parser.getST());
+            string outputName = argc > 3 ? argv[3] : "program.s";
+            ofstream out(outputName, ios::binary);
+            if (!out) throw runtime_error("Cannot write file: " + outputName);
+            writeAssembly(program, out);
+            cout << "Wrote assembly to '" << outputName << "'" << endl;
+            return 0;
+        }
+
+        if (argc > 1 && (string(argv[1]) == "--run" || string(argv[1]) == "--disasm")) {
+            if (argc > 3) {
+                cerr << "Usage: " << argv[0] << " " << argv[1] << " [lexer.txt | tokens.bin]" << endl;
+                return 1;
+            }
+            TokenArray tokens = loadTokens(argc > 2 ? argv[2] : "lexer.txt", false);
+            Parser parser(tokens);
+            parser.setVerbose(false);
+            parser.parse();
+            foldConstants(*parser.getST());
+            Bytecode program = compileProgram(*parser.getST());
+            if (string(argv[1]) == "--disasm") printBytecode(program, cout);
+            else runBytecode(program, cout);
+            return 0;
+        }
+
+        // --all-errors reports every error instead of stopping at the first,
+        // and still prints and saves the partial tree.
+        if (argc > 1 && string(argv[1]) == "--all-errors") {
+            TokenArray tokens = loadTokens(argc > 2 ? argv[2] : "lexer.txt");
+            Parser parser(tokens);
+            bool ok = parser.parseWithRecovery();
+            for (const ParseDiagnostic& diagnostic : parser.getDiagnostics()) {
+                cerr << "Error";
+                if (diagnostic.line >= 0) cerr << " at line " << diagnostic.line;
+                cerr << ": " << diagnostic.message() << endl;
+            }
+            if (!ok) cerr << parser.getDiagnostics().size() << " error(s)" << endl;
+            parser.print();
+            parser.saveTreeToFile("syntax_tree.txt");
+            return ok ? 0 : 1;
+        }
+
+        // --parallel [threads] parses function bodies on a thread pool;
+        // --fold folds constant expressions before the tree is printed;
+        // --hash-cons stores identical subtrees once.
+        bool parallel = argc > 1 && string(argv[1]) == "--parallel";
+        int threads = parallel && argc > 2 ? stoi(argv[2]) : 0;
+        bool fold = argc > 1 && string(argv[1]) == "--fold";
+        bool hashCons = argc > 1 && string(argv[1]) == "--hash-cons";
+
         TokenArray tokens = loadTokens("lexer.txt");
 
         if (tokens.empty()) {
@@ -14,7 +194,25 @@ int main() {
         }
 
         Parser parser(tokens);
-        parser.parse();
+        if (parallel) {
+            parser.parseParallel(threads);
+        }
+        else {
+            parser.parse();
+        }
+        if (fold) {
+            FoldStats stats = foldConstants(*parser.getST());
+            cout << "Constant folding: " << stats.folded << " operations folded, " << stats.substituted
+                << " constants substituted, " << stats.removed << " nodes removed";
+            if (stats.kept) cout << ", " << stats.kept << " kept (division by zero or overflow)";
+            cout << endl;
+        }
+        if (hashCons) {
+            HashConsStats stats = hashConsTree(*parser.getST());
+            cout << "Hash-consing: " << stats.nodesBefore << " -> " << stats.nodesAfter << " nodes, "
+                << stats.bytesBefore << " -> " << stats.bytesAfter << " bytes, " << stats.occurrences
+                << " nodes in the printed tree" << endl;
+        }
         parser.print();
         parser.saveTreeToFile("syntax_tree.txt");
 
@@ -0,0 +1,39 @@
+#include "textwriter.h"
+
+TextWriter::TextWriter(ostream& out)
+    : buffer(new char[BUFFER_SIZE]), used(0), stream(&out), text(nullptr) {}
+
+TextWriter::TextWriter(string& out)
+    : buffer(new char[BUFFER_SIZE]), used(0), stream(nullptr), text(&out) {}
+
+TextWriter::~TextWriter() {
+    drain();
+    if (stream) stream->flush();
+    delete[] buffer;
+}
+
+void TextWriter::drain() {
+    if (used == 0) return;
+    if (stream) stream->write(buffer, (streamsize)used);
+    else text->append(buffer, used);
+    used = 0;
+}
+
+void TextWriter::putLong(string_view data) {
+    drain();
+    if (data.size() < BUFFER_SIZE) {
+        memcpy(buffer, data.data(), data.size());
+        used = data.size();
+    }
+    else if (stream) {
+        stream->write(data.data(), (streamsize)data.size());
+    }
+    else {
+        text->append(data.data(), data.size());
+    }
+}
+
+void TextWriter::flush() {
+    drain();
+    if (stream) stream->flush();
+}
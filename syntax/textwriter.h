@@ -0,0 +1,67 @@
+#pragma once
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Output buffer for the tree printers. Text is gathered in one reusable
+// 64 KB block and handed to the target in whole blocks: a stream (a file
+// or cout) or a string kept in memory. Whatever is left goes out on
+// flush() or when the writer is destroyed.
+class TextWriter {
+private:
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    char* buffer;
+    size_t used;
+    ostream* stream;
+    string* text;
+
+    void drain();
+    void putLong(string_view data);
+
+public:
+    explicit TextWriter(ostream& out);
+    explicit TextWriter(string& out);
+    ~TextWriter();
+
+    TextWriter(const TextWriter&) = delete;
+    TextWriter& operator=(const TextWriter&) = delete;
+
+    void put(char c) {
+        if (used == BUFFER_SIZE) drain();
+        buffer[used++] = c;
+    }
+
+    void put(string_view data) {
+        if (data.size() > BUFFER_SIZE - used) {
+            putLong(data);
+            return;
+        }
+        memcpy(buffer + used, data.data(), data.size());
+        used += data.size();
+    }
+
+    void indent(int spaces) {
+        while (spaces > 0) {
+            if (used == BUFFER_SIZE) drain();
+            size_t count = BUFFER_SIZE - used < (size_t)spaces ? BUFFER_SIZE - used : (size_t)spaces;
+            memset(buffer + used, ' ', count);
+            used += count;
+            spaces -= (int)count;
+        }
+    }
+
+    // A node as STData::toString() spells it: "TYPE" or "TYPE:value".
+    void label(string_view type, string_view value) {
+        put(type);
+        if (!value.empty() && value != type) {
+            put(':');
+            put(value);
+        }
+    }
+
+    void flush();
+};
@@ -0,0 +1,111 @@
+#include "threadpool.h"
+
+// Pool and worker index of the calling thread, if it is a pool worker.
+static thread_local const WorkStealingPool* currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+WorkStealingPool::WorkStealingPool(int threadCount)
+    : queued(0), pending(0), nextWorker(0), stopping(false) {
+    if (threadCount <= 0) {
+        threadCount = (int)thread::hardware_concurrency();
+        if (threadCount <= 0) threadCount = 1;
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+        workers.push_back(make_unique<Worker>());
+    }
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        lock_guard<mutex> guard(idleLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+void WorkStealingPool::submit(function<void()> task) {
+    int target = currentPool == this ? currentWorker :
+        (int)(nextWorker++ % (unsigned int)workers.size());
+
+    pending++;
+    {
+        lock_guard<mutex> guard(workers[target]->lock);
+        workers[target]->tasks.push_back(move(task));
+    }
+    {
+        // Counted under idleLock so a worker about to sleep cannot miss it.
+        lock_guard<mutex> guard(idleLock);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+bool WorkStealingPool::popLocal(int self, function<void()>& task) {
+    Worker& worker = *workers[self];
+    lock_guard<mutex> guard(worker.lock);
+    if (worker.tasks.empty()) return false;
+    task = move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(int self, function<void()>& task) {
+    int count = (int)workers.size();
+    for (int i = 1; i < count; i++) {
+        Worker& victim = *workers[(self + i) % count];
+        lock_guard<mutex> guard(victim.lock);
+        if (victim.tasks.empty()) continue;
+        task = move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::workerLoop(int self) {
+    currentPool = this;
+    currentWorker = self;
+
+    function<void()> task;
+    while (true) {
+        if (popLocal(self, task) || steal(self, task)) {
+            queued--;
+            try {
+                task();
+            }
+            catch (...) {
+                lock_guard<mutex> guard(idleLock);
+                if (!firstError) firstError = current_exception();
+            }
+            task = nullptr;
+
+            if (--pending == 0) {
+                lock_guard<mutex> guard(idleLock);
+                finished.notify_all();
+            }
+            continue;
+        }
+
+        unique_lock<mutex> idle(idleLock);
+        wake.wait(idle, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
+
+void WorkStealingPool::wait() {
+    unique_lock<mutex> idle(idleLock);
+    finished.wait(idle, [this] { return pending == 0; });
+
+    if (firstError) {
+        exception_ptr error = firstError;
+        firstError = nullptr;
+        rethrow_exception(error);
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of worker threads, each with its own task deque. A worker runs
+// the newest task of its own deque first and, when that is empty, steals
+// the oldest task from another worker. Tasks submitted from inside a task
+// go to the running worker's deque; others are dealt round-robin.
+class WorkStealingPool {
+private:
+    struct Worker {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+
+    mutex idleLock;
+    condition_variable wake;      // tasks were queued or the pool is stopping
+    condition_variable finished;  // pending dropped to zero
+    atomic<int> queued;           // tasks sitting in some deque
+    atomic<int> pending;          // tasks submitted and not yet finished
+    atomic<unsigned int> nextWorker;
+    bool stopping;
+    exception_ptr firstError;
+
+    bool popLocal(int self, function<void()>& task);
+    bool steal(int self, function<void()>& task);
+    void workerLoop(int self);
+
+public:
+    // threads <= 0 means one per hardware thread.
+    explicit WorkStealingPool(int threads = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int threadCount() const { return (int)workers.size(); }
+
+    void submit(function<void()> task);
+
+    // Blocks until every submitted task has finished, then rethrows the
+    // first exception a task let escape, if any.
+    void wait();
+};
@@ -0,0 +1,20 @@
+#include "token.h"
+#include "tokenbin.h"
+#include "tokenscan.h"
+
+TokenArray loadTokens(const string& filename, bool verbose) {
+    shared_ptr<const MappedFile> file = make_shared<MappedFile>(filename);
+    if (isBinaryTokenData(file->view())) {
+        TokenArray tokens = loadBinaryTokens(file, filename);
+        if (verbose) cout << "Loaded " << tokens.size() << " tokens" << endl;
+        return tokens;
+    }
+
+    TokenArray tokens;
+    tokens.setSource(file);
+
+    tokens.reserve(countLines(file->begin(), file->end()) + 1);
+    int count = scanTokenText(file->begin(), file->end(), tokens);
+    if (verbose) cout << "Loaded " << count << " tokens" << endl;
+    return tokens;
+}
@@ -1,24 +1,127 @@
 #pragma once
+#include "mappedfile.h"
 #include <string>
-#include <fstream>
+#include <string_view>
+#include <memory>
 #include <iostream>
 #include <stdexcept>
 
 using namespace std;
 
+enum TokenKind : unsigned char {
+    TOKEN_ID,
+    TOKEN_HEXNUM,
+    TOKEN_DECNUM,
+    TOKEN_SEP,
+    TOKEN_KEYWORD,
+    TOKEN_INVALID
+};
+
+// Fixed spellings of keywords and separators, resolved once when a token is
+// loaded so the parser compares small integers instead of strings.
+enum Lexeme : unsigned char {
+    LX_NONE,
+    KW_PROGRAM,
+    KW_CONST,
+    KW_VAR,
+    KW_FUNCTION,
+    KW_BEGIN,
+    KW_END,
+    KW_INTEGER,
+    KW_DIV,
+    KW_WRITELN,
+    SEP_SEMICOLON,
+    SEP_COMMA,
+    SEP_COLON,
+    SEP_ASSIGN,
+    SEP_LPAREN,
+    SEP_RPAREN,
+    SEP_DOT,
+    SEP_EQUAL,
+    SEP_PLUS,
+    SEP_MINUS,
+    SEP_STAR,
+    SEP_SLASH,
+    LX_COUNT
+};
+
+inline string_view lexemeText(int lexeme) {
+    static const string_view texts[LX_COUNT] = {
+        "", "program", "const", "var", "function", "begin", "end", "integer", "div", "writeln",
+        ";", ",", ":", ":=", "(", ")", ".", "=", "+", "-", "*", "/"
+    };
+    return (lexeme >= 0 && lexeme < LX_COUNT) ? texts[lexeme] : "";
+}
+
+// Every keyword and separator differs from the others of its kind in the
+// first character (":" and ":=" by length), so one switch picks the only
+// candidate and a single compare confirms it.
+inline int lookupLexeme(int kind, string_view value) {
+    if (value.empty()) return LX_NONE;
+
+    int candidate = LX_NONE;
+    if (kind == TOKEN_KEYWORD) {
+        switch (value[0]) {
+        case 'p': candidate = KW_PROGRAM; break;
+        case 'c': candidate = KW_CONST; break;
+        case 'v': candidate = KW_VAR; break;
+        case 'f': candidate = KW_FUNCTION; break;
+        case 'b': candidate = KW_BEGIN; break;
+        case 'e': candidate = KW_END; break;
+        case 'i': candidate = KW_INTEGER; break;
+        case 'd': candidate = KW_DIV; break;
+        case 'w': candidate = KW_WRITELN; break;
+        }
+    }
+    else if (kind == TOKEN_SEP) {
+        switch (value[0]) {
+        case ';': candidate = SEP_SEMICOLON; break;
+        case ',': candidate = SEP_COMMA; break;
+        case ':': candidate = value.size() > 1 ? SEP_ASSIGN : SEP_COLON; break;
+        case '(': candidate = SEP_LPAREN; break;
+        case ')': candidate = SEP_RPAREN; break;
+        case '.': candidate = SEP_DOT; break;
+        case '=': candidate = SEP_EQUAL; break;
+        case '+': candidate = SEP_PLUS; break;
+        case '-': candidate = SEP_MINUS; break;
+        case '*': candidate = SEP_STAR; break;
+        case '/': candidate = SEP_SLASH; break;
+        }
+    }
+    return (candidate != LX_NONE && lexemeText(candidate) == value) ? candidate : LX_NONE;
+}
+
+inline string_view tokenTypeName(int typeCode) {
+    switch (typeCode) {
+    case TOKEN_ID: return "ID";
+    case TOKEN_HEXNUM: return "HEXNUM";
+    case TOKEN_DECNUM: return "DECNUM";
+    case TOKEN_SEP: return "SEP";
+    case TOKEN_KEYWORD: return "KEYWORD";
+    default: return "";
+    }
+}
+
+// value is a slice into the buffer the token was loaded from (see
+// TokenArray::setSource); a Token never owns its text.
 struct Token {
     int line;
-    string type;
-    string value;
+    unsigned char kind;
+    unsigned char lexeme;
+    string_view value;
 
-    Token() : line(-1), type(""), value("") {}
+    Token() : line(-1), kind(TOKEN_INVALID), lexeme(LX_NONE), value("") {}
 
-    Token(int l, const string& t, const string& v)
-        : line(l), type(t), value(v) {
+    Token(int l, int k, string_view v)
+        : line(l), kind((unsigned char)k), lexeme((unsigned char)lookupLexeme(k, v)), value(v) {
+    }
+
+    string_view typeName() const {
+        return tokenTypeName(kind);
     }
 
     string toString() const {
-        return "Line " + to_string(line) + ": " + type + " '" + value + "'";
+        return "Line " + to_string(line) + ": " + string(typeName()) + " '" + string(value) + "'";
     }
 };
 
@@ -27,6 +130,7 @@ private:
     Token* data;
     int capacity;
     int length;
+    shared_ptr<const MappedFile> source;
 
     void resize(int newCapacity) {
         if (newCapacity <= 0) newCapacity = 1;
@@ -48,7 +152,7 @@ public:
         resize(10);
     }
 
-    TokenArray(const TokenArray& other) : data(nullptr), capacity(0), length(0) {
+    TokenArray(const TokenArray& other) : data(nullptr), capacity(0), length(0), source(other.source) {
         resize(other.capacity);
         length = other.length;
         for (int i = 0; i < length; i++) {
@@ -56,6 +160,13 @@ public:
         }
     }
 
+    TokenArray(TokenArray&& other) noexcept
+        : data(other.data), capacity(other.capacity), length(other.length), source(move(other.source)) {
+        other.data = nullptr;
+        other.capacity = 0;
+        other.length = 0;
+    }
+
     ~TokenArray() {
         delete[] data;
     }
@@ -66,6 +177,7 @@ public:
             data = nullptr;
             capacity = 0;
             length = 0;
+            source = other.source;
             resize(other.capacity);
             length = other.length;
             for (int i = 0; i < length; i++) {
@@ -75,6 +187,20 @@ public:
         return *this;
     }
 
+    TokenArray& operator=(TokenArray&& other) noexcept {
+        if (this != &other) {
+            delete[] data;
+            data = other.data;
+            capacity = other.capacity;
+            length = other.length;
+            source = move(other.source);
+            other.data = nullptr;
+            other.capacity = 0;
+            other.length = 0;
+        }
+        return *this;
+    }
+
     void push_back(const Token& token) {
         if (length >= capacity) {
             resize(capacity * 2);
@@ -83,8 +209,22 @@ public:
         length++;
     }
 
-    void emplace_back(int line, const string& type, const string& value) {
-        push_back(Token(line, type, value));
+    void emplace_back(int line, int kind, string_view value) {
+        if (length >= capacity) {
+            resize(capacity * 2);
+        }
+        data[length++] = Token(line, kind, value);
+    }
+
+    void reserve(int count) {
+        if (count > capacity) {
+            resize(count);
+        }
+    }
+
+    // Keeps the buffer the token views point into alive as long as this array.
+    void setSource(shared_ptr<const MappedFile> file) {
+        source = move(file);
     }
 
     Token& operator[](int index) {
@@ -114,16 +254,7 @@ public:
     }
 };
 
-inline int tokenTypeCode(const string& typeStr) {
-    if (typeStr == "ID") return 0;
-    if (typeStr == "HEXNUM") return 1;
-    if (typeStr == "DECNUM") return 2;
-    if (typeStr == "SEP") return 3;
-    if (typeStr == "KEYWORD") return 4;
-    return -1;
-}
-
-inline bool isNumberString(const string& str) {
+inline bool isNumberString(string_view str) {
     if (str.empty()) return false;
     for (int i = 0; i < (int)str.length(); i++) {
         if (str[i] < '0' || str[i] > '9') return false;
@@ -131,80 +262,54 @@ inline bool isNumberString(const string& str) {
     return true;
 }
 
-inline int stringToInt(const string& str) {
-    int result = 0;
+// Wraps around on overflow instead of invoking undefined behaviour.
+inline int stringToInt(string_view str) {
+    unsigned int result = 0;
     for (int i = 0; i < (int)str.length(); i++) {
-        result = result * 10 + (str[i] - '0');
+        result = result * 10 + (unsigned int)(str[i] - '0');
     }
-    return result;
+    return (int)result;
 }
 
-inline bool parseTokenLine(const string& line, int& outLine, string& outType, string& outValue) {
+inline bool parseTokenLine(string_view line, Token& out) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
     if (line.empty()) return false;
 
-    int pos = 0;
+    size_t pos = 0;
     while (pos < line.length() && line[pos] == ' ') pos++;
     if (pos == line.length()) return false;
 
-    int pos1 = line.find(' ', pos);
-    if (pos1 == string::npos) return false;
-    string linePart = line.substr(pos, pos1 - pos);
+    size_t pos1 = line.find(' ', pos);
+    if (pos1 == string_view::npos) return false;
+    string_view linePart = line.substr(pos, pos1 - pos);
     if (!isNumberString(linePart)) return false;
-    outLine = stringToInt(linePart);
+    int lineNum = stringToInt(linePart);
 
     pos = pos1 + 1;
     while (pos < line.length() && line[pos] == ' ') pos++;
     if (pos >= line.length()) return false;
 
-    int pos2 = line.find(' ', pos);
-    string typeCodeStr = (pos2 == string::npos) ? line.substr(pos) : line.substr(pos, pos2 - pos);
+    size_t pos2 = line.find(' ', pos);
+    string_view typeCodeStr = (pos2 == string_view::npos) ? line.substr(pos) : line.substr(pos, pos2 - pos);
     if (!isNumberString(typeCodeStr)) return false;
     int typeCode = stringToInt(typeCodeStr);
+    if (typeCode < TOKEN_ID || typeCode >= TOKEN_INVALID) return false;
 
-    switch (typeCode) {
-    case 0: outType = "ID"; break;
-    case 1: outType = "HEXNUM"; break;
-    case 2: outType = "DECNUM"; break;
-    case 3: outType = "SEP"; break;
-    case 4: outType = "KEYWORD"; break;
-    default: return false;
-    }
-
-    if (pos2 == string::npos) {
-        outValue = "";
-    }
-    else {
-        int valStart = pos2 + 1;
-        while (valStart < line.length() && line[valStart] == ' ') valStart;
-        if (valStart >= line.length()) {
-            outValue = "";
-        }
-        else {
-            outValue = line.substr(valStart);
+    string_view value;
+    if (pos2 != string_view::npos) {
+        size_t valStart = pos2 + 1;
+        while (valStart < line.length() && line[valStart] == ' ') valStart++;
+        if (valStart < line.length()) {
+            value = line.substr(valStart);
         }
     }
 
+    out = Token(lineNum, typeCode, value);
     return true;
 }
 
-inline TokenArray loadTokens(const string& filename) {
-    TokenArray tokens;
-    ifstream file(filename);
-    if (!file.is_open()) {
-        throw runtime_error("Cannot open file: " + filename);
-    }
-    string line;
-    int count = 0;
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        int lineNum;
-        string type, value;
-        if (parseTokenLine(line, lineNum, type, value)) {
-            tokens.emplace_back(lineNum, type, value);
-            count++;
-        }
-    }
-    file.close();
-    cout << "Loaded " << count << " tokens" << endl;
-    return tokens;
-}
+// Maps the file and slices tokens straight out of the mapping; the returned
+// array keeps the mapping alive. Accepts both the text "line typecode value"
+// format and the binary format from tokenbin.h. verbose reports the token
+// count on cout.
+TokenArray loadTokens(const string& filename, bool verbose = true);
@@ -0,0 +1,110 @@
+#include "tokenbin.h"
+#include "binaryio.h"
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+static_assert(LX_COUNT <= 32, "Lexeme must fit in the upper 5 bits of a token tag");
+
+bool isBinaryTokenData(string_view data) {
+    return data.size() >= sizeof(TOKEN_BINARY_MAGIC) &&
+        memcmp(data.data(), TOKEN_BINARY_MAGIC, sizeof(TOKEN_BINARY_MAGIC)) == 0;
+}
+
+TokenArray loadBinaryTokens(shared_ptr<const MappedFile> file, const string& filename) {
+    BinaryReader in{ (const unsigned char*)file->begin(), (const unsigned char*)file->end(), filename,
+        "binary token file" };
+    in.bytes(sizeof(TOKEN_BINARY_MAGIC));
+    if (in.byte() != TOKEN_BINARY_VERSION) {
+        throw runtime_error("Unsupported binary token file version: " + filename);
+    }
+
+    unsigned int stringCount = in.varint();
+    unsigned int tokenCount = in.varint();
+    if (stringCount > file->size() || tokenCount > file->size()) in.corrupt();
+
+    vector<string_view> strings(stringCount);
+    for (unsigned int i = 0; i < stringCount; i++) {
+        strings[i] = in.bytes(in.varint());
+    }
+
+    TokenArray tokens;
+    tokens.setSource(file);
+    tokens.reserve((int)tokenCount);
+
+    int line = 0;
+    for (unsigned int i = 0; i < tokenCount; i++) {
+        unsigned char tag = in.byte();
+        int kind = tag & 0x07;
+        int lexeme = tag >> 3;
+        if (kind >= TOKEN_INVALID || lexeme >= LX_COUNT) in.corrupt();
+
+        string_view value;
+        if (lexeme != LX_NONE) {
+            value = lexemeText(lexeme);
+        }
+        else {
+            unsigned int index = in.varint();
+            if (index >= stringCount) in.corrupt();
+            value = strings[index];
+        }
+        line += unzigzag(in.varint());
+
+        Token token;
+        token.line = line;
+        token.kind = (unsigned char)kind;
+        token.lexeme = (unsigned char)lexeme;
+        token.value = value;
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+void saveTokensBinary(const TokenArray& tokens, const string& filename) {
+    unordered_map<string_view, unsigned int> stringIndex;
+    vector<string_view> strings;
+    string body;
+    body.reserve((size_t)tokens.size() * 4);
+
+    int line = 0;
+    for (int i = 0; i < tokens.size(); i++) {
+        const Token& token = tokens[i];
+        body.push_back((char)(token.kind | (token.lexeme << 3)));
+        if (token.lexeme == LX_NONE) {
+            auto found = stringIndex.find(token.value);
+            if (found == stringIndex.end()) {
+                found = stringIndex.emplace(token.value, (unsigned int)strings.size()).first;
+                strings.push_back(token.value);
+            }
+            putVarint(body, found->second);
+        }
+        putVarint(body, zigzag(token.line - line));
+        line = token.line;
+    }
+
+    string out(TOKEN_BINARY_MAGIC, sizeof(TOKEN_BINARY_MAGIC));
+    out.push_back((char)TOKEN_BINARY_VERSION);
+    putVarint(out, (unsigned int)strings.size());
+    putVarint(out, (unsigned int)tokens.size());
+    for (string_view str : strings) {
+        putVarint(out, (unsigned int)str.size());
+        out.append(str.data(), str.size());
+    }
+    out += body;
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        throw runtime_error("Cannot open file: " + filename);
+    }
+    file.write(out.data(), (streamsize)out.size());
+    if (!file) {
+        throw runtime_error("Cannot write file: " + filename);
+    }
+}
+
+int convertTokenFile(const string& textFile, const string& binaryFile) {
+    TokenArray tokens = loadTokens(textFile);
+    saveTokensBinary(tokens, binaryFile);
+    return tokens.size();
+}
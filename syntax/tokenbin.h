@@ -0,0 +1,29 @@
+#pragma once
+#include "token.h"
+#include <string>
+#include <string_view>
+#include <memory>
+
+using namespace std;
+
+// Binary token stream, produced once from lexer.txt and then loaded many
+// times without re-parsing any text:
+//
+//   "STOK" version:u8 stringCount:varint tokenCount:varint
+//   stringCount x (length:varint bytes)
+//   tokenCount x (tag:u8 [string:varint] lineDelta:zigzag-varint)
+//
+// tag holds the TokenKind in the low 3 bits and the Lexeme in the upper 5.
+// Keywords and separators with a known Lexeme carry no string index; every
+// other token names an entry of the string table.
+
+const char TOKEN_BINARY_MAGIC[4] = { 'S', 'T', 'O', 'K' };
+const unsigned char TOKEN_BINARY_VERSION = 1;
+
+bool isBinaryTokenData(string_view data);
+
+TokenArray loadBinaryTokens(shared_ptr<const MappedFile> file, const string& filename);
+void saveTokensBinary(const TokenArray& tokens, const string& filename);
+
+// Text lexer.txt -> binary token file. Returns the number of tokens written.
+int convertTokenFile(const string& textFile, const string& binaryFile);
@@ -0,0 +1,171 @@
+#include "tokenscan.h"
+#include <cstdint>
+#include <cstring>
+
+// Define TOKEN_SCAN_NO_SIMD to build the portable mask loops on x86 too.
+#if defined(TOKEN_SCAN_NO_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define TOKEN_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TOKEN_SCAN_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const int BLOCK = 64;
+
+static inline int lowestBit(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+static inline int bitCount(uint64_t mask) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(mask);
+#else
+    return __builtin_popcountll(mask);
+#endif
+}
+
+// Bit i of the result is set when block[i] is '\n'.
+static inline uint64_t newlineMask(const char* block) {
+#if defined(TOKEN_SCAN_AVX2)
+    const __m256i nl = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl)) |
+        ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32);
+#elif defined(TOKEN_SCAN_SSE2)
+    const __m128i nl = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    for (int i = 0; i < BLOCK; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(block + i));
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl)) << i;
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (int i = 0; i < BLOCK; i++) {
+        mask |= (uint64_t)(block[i] == '\n') << i;
+    }
+    return mask;
+#endif
+}
+
+const char* tokenScanKind() {
+#if defined(TOKEN_SCAN_AVX2)
+    return "AVX2";
+#elif defined(TOKEN_SCAN_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+int countLines(const char* begin, const char* end) {
+    size_t length = end - begin;
+    size_t base = 0;
+    int count = 0;
+
+    for (; base + BLOCK <= length; base += BLOCK) {
+        count += bitCount(newlineMask(begin + base));
+    }
+    for (; base < length; base++) {
+        count += begin[base] == '\n';
+    }
+    return count;
+}
+
+// The shape lexer.txt actually has: "<digits> <digit> <value>" with single
+// spaces and an optional '\r'. Anything else is left to parseTokenLine,
+// which also rejects it or reads it the same way.
+static inline bool decodeRegularLine(const char* p, const char* end, TokenArray& tokens) {
+    const char* digits = p;
+    unsigned int line = 0;
+    for (; p < end; p++) {
+        unsigned int digit = (unsigned int)(*p - '0');
+        if (digit > 9) break;
+        line = line * 10 + digit;
+    }
+    if (p == digits || end - p < 3 || p[0] != ' ' || p[2] != ' ') return false;
+
+    unsigned int kind = (unsigned int)(p[1] - '0');
+    if (kind >= TOKEN_INVALID) return false;
+
+    p += 3;
+    if (p < end && *p == ' ') return false;
+    if (end > p && end[-1] == '\r') end--;
+
+    tokens.emplace_back((int)line, (int)kind, string_view(p, end - p));
+    return true;
+}
+
+int scanTokenText(const char* begin, const char* end, TokenArray& tokens) {
+    size_t length = end - begin;
+    size_t lineStart = 0;
+    int count = 0;
+    char tail[BLOCK];
+
+    // One extra round flushes a last line without '\n'.
+    for (size_t base = 0; base <= length; base += BLOCK) {
+        uint64_t newlines;
+        if (length - base >= (size_t)BLOCK) {
+            newlines = newlineMask(begin + base);
+        }
+        else {
+            memset(tail, 0, BLOCK);
+            if (length > base) memcpy(tail, begin + base, length - base);
+            tail[length - base] = '\n';
+            newlines = newlineMask(tail);
+        }
+
+        while (newlines) {
+            size_t pos = base + lowestBit(newlines);
+            newlines &= newlines - 1;
+
+            const char* line = begin + lineStart;
+            const char* eol = begin + pos;
+            lineStart = pos + 1;
+            if (line == eol) continue;
+
+            if (decodeRegularLine(line, eol, tokens)) {
+                count++;
+                continue;
+            }
+            Token token;
+            if (parseTokenLine(string_view(line, eol - line), token)) {
+                tokens.push_back(token);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+int scanTokenTextByLine(const char* begin, const char* end, TokenArray& tokens) {
+    const char* pos = begin;
+    int count = 0;
+    while (pos < end) {
+        const char* eol = (const char*)memchr(pos, '\n', end - pos);
+        if (!eol) eol = end;
+        string_view line(pos, eol - pos);
+        pos = eol + 1;
+
+        if (line.empty()) continue;
+        Token token;
+        if (parseTokenLine(line, token)) {
+            tokens.push_back(token);
+            count++;
+        }
+    }
+    return count;
+}
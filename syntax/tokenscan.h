@@ -0,0 +1,24 @@
+#pragma once
+#include "token.h"
+
+using namespace std;
+
+// Block scanner for the text token format "line typecode value\n".
+//
+// Newlines are located 64 bytes at a time as a bitmask (AVX2 or SSE2 when
+// the compiler targets them, a plain loop otherwise) and each line is then
+// decoded in place with no find() calls or temporaries. Lines that do not
+// have the regular "digits digit value" shape are handed to parseTokenLine,
+// so the result is always the same as the line-by-line path.
+
+// Name of the newline search compiled in: "AVX2", "SSE2" or "scalar".
+const char* tokenScanKind();
+
+int countLines(const char* begin, const char* end);
+
+// Appends every token of [begin, end) to tokens and returns how many were
+// added. Token values point into the buffer.
+int scanTokenText(const char* begin, const char* end, TokenArray& tokens);
+
+// The reference path: memchr per line and parseTokenLine per line.
+int scanTokenTextByLine(const char* begin, const char* end, TokenArray& tokens);
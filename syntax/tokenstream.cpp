@@ -0,0 +1,165 @@
+#include "tokenstream.h"
+#include "tokenbin.h"
+#include "tokenscan.h"
+
+void TokenStream::nextWindow() {
+    base += (int)(limit - window);
+    const Token* begin;
+    const Token* end;
+    while (fetch(begin, end)) {
+        if (begin != end) {
+            window = cursor = begin;
+            limit = end;
+            return;
+        }
+    }
+    window = cursor = limit = nullptr;
+}
+
+ArrayTokenStream::ArrayTokenStream(const TokenArray& tokens, int start)
+    : TokenStream(start), first(nullptr), last(nullptr) {
+    if (start >= 0 && start < tokens.size()) {
+        first = &tokens[start];
+        last = first + (tokens.size() - start);
+    }
+    nextWindow();
+}
+
+bool ArrayTokenStream::fetch(const Token*& begin, const Token*& end) {
+    if (!first) return false;
+    begin = first;
+    end = last;
+    first = last = nullptr;
+    return true;
+}
+
+TokenPipeline::TokenPipeline(istream& in, size_t bytes, int depth)
+    : input(in), chunkBytes(bytes ? bytes : 1), current(nullptr), previous(nullptr),
+    finished(false), stopping(false) {
+    // depth waiting + the parser's current and previous + one being filled.
+    int count = (depth > 0 ? depth : 1) + 3;
+    for (int i = 0; i < count; i++) {
+        chunks.push_back(make_unique<Chunk>());
+        spare.push_back(chunks.back().get());
+    }
+
+    producer = thread(&TokenPipeline::produce, this);
+    try {
+        nextWindow();
+    }
+    catch (...) {
+        // The destructor does not run for a failed constructor, and a
+        // joinable thread would terminate the program.
+        stopProducer();
+        throw;
+    }
+}
+
+TokenPipeline::~TokenPipeline() {
+    stopProducer();
+}
+
+void TokenPipeline::stopProducer() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    freeChanged.notify_all();
+    producer.join();
+}
+
+void TokenPipeline::produce() {
+    // Tail of the last chunk after its final '\n', continued by the next one.
+    string carry;
+    bool first = true;
+
+    try {
+        while (true) {
+            Chunk* chunk;
+            {
+                unique_lock<mutex> guard(lock);
+                freeChanged.wait(guard, [this] { return stopping || !spare.empty(); });
+                if (stopping) return;
+                chunk = spare.back();
+                spare.pop_back();
+            }
+
+            string& text = chunk->text;
+            size_t kept = carry.size();
+            text.assign(carry);
+            text.resize(kept + chunkBytes);
+            input.read(&text[kept], (streamsize)chunkBytes);
+            size_t got = (size_t)input.gcount();
+            text.resize(kept + got);
+            if (input.bad()) {
+                throw runtime_error("Cannot read token input");
+            }
+            bool atEof = got < chunkBytes;
+
+            if (first) {
+                if (isBinaryTokenData(text)) {
+                    throw runtime_error("Binary token files cannot be streamed; convert them back to text");
+                }
+                first = false;
+            }
+
+            size_t cut = text.size();
+            if (!atEof) {
+                size_t newline = text.rfind('\n');
+                cut = newline == string::npos ? 0 : newline + 1;
+            }
+            carry.assign(text, cut, string::npos);
+
+            chunk->tokens.clear();
+            scanTokenText(text.data(), text.data() + cut, chunk->tokens);
+
+            {
+                lock_guard<mutex> guard(lock);
+                ready.push_back(chunk);
+                finished = atEof;
+            }
+            readyChanged.notify_one();
+            if (atEof) return;
+        }
+    }
+    catch (...) {
+        {
+            lock_guard<mutex> guard(lock);
+            error = current_exception();
+            finished = true;
+        }
+        readyChanged.notify_one();
+    }
+}
+
+bool TokenPipeline::fetch(const Token*& begin, const Token*& end) {
+    unique_lock<mutex> guard(lock);
+    if (previous) {
+        spare.push_back(previous);
+        freeChanged.notify_one();
+    }
+    previous = current;
+    current = nullptr;
+
+    while (true) {
+        readyChanged.wait(guard, [this] { return finished || !ready.empty(); });
+        if (ready.empty()) {
+            if (error) rethrow_exception(error);
+            return false;
+        }
+
+        Chunk* chunk = ready.front();
+        ready.pop_front();
+        if (chunk->tokens.empty()) {
+            // Part of a line longer than a chunk; previous stays as it is.
+            spare.push_back(chunk);
+            freeChanged.notify_one();
+            continue;
+        }
+
+        current = chunk;
+        begin = &chunk->tokens[0];
+        end = begin + chunk->tokens.size();
+        return true;
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "token.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Forward-only view of a token sequence as the parser sees it: the current
+// token, advance(), and the running position. Tokens arrive in windows of
+// consecutive tokens; a subclass hands out the next window when the current
+// one is used up, so stepping to the next token is a pointer increment.
+class TokenStream {
+private:
+    const Token* window;
+    const Token* cursor;
+    const Token* limit;
+    int base;           // position of window[0]
+
+protected:
+    // Stores the next window in [begin, end); false at the end of input.
+    virtual bool fetch(const Token*& begin, const Token*& end) = 0;
+
+    // Subclass constructors call this once they can serve fetch().
+    void nextWindow();
+
+public:
+    // start is the position reported for the first token.
+    explicit TokenStream(int start = 0) : window(nullptr), cursor(nullptr), limit(nullptr), base(start) {}
+    virtual ~TokenStream() {}
+
+    TokenStream(const TokenStream&) = delete;
+    TokenStream& operator=(const TokenStream&) = delete;
+
+    bool atEnd() const { return cursor == limit; }
+    const Token& peek() const { return *cursor; }   // only when !atEnd()
+    int position() const { return base + (int)(cursor - window); }
+
+    void advance() {
+        if (cursor != limit && ++cursor == limit) nextWindow();
+    }
+};
+
+// The whole input at once, straight out of a TokenArray.
+class ArrayTokenStream : public TokenStream {
+private:
+    const Token* first;     // handed out by the first fetch()
+    const Token* last;
+
+protected:
+    bool fetch(const Token*& begin, const Token*& end) override;
+
+public:
+    ArrayTokenStream() : first(nullptr), last(nullptr) {}
+    // Starts at tokens[start]; positions stay indices into tokens.
+    explicit ArrayTokenStream(const TokenArray& tokens, int start = 0);
+};
+
+// Text token input (lexer.txt format) read and scanned on a producer thread
+// while the parser consumes it. The input is read in chunks of chunkBytes;
+// at most depth scanned chunks wait for the parser, so memory for tokens
+// stays the same however long the input is. A token's value stays valid
+// until the parser has moved through the whole following chunk.
+class TokenPipeline : public TokenStream {
+private:
+    struct Chunk {
+        string text;
+        TokenArray tokens;
+    };
+
+    istream& input;
+    size_t chunkBytes;
+    vector<unique_ptr<Chunk>> chunks;
+
+    mutex lock;
+    condition_variable readyChanged;
+    condition_variable freeChanged;
+    deque<Chunk*> ready;        // scanned, in input order
+    vector<Chunk*> spare;       // free for the producer to fill
+    Chunk* current;             // the parser's window
+    Chunk* previous;            // kept so values from it stay valid
+    bool finished;
+    bool stopping;
+    exception_ptr error;
+
+    thread producer;
+
+    void produce();
+    void stopProducer();
+
+protected:
+    bool fetch(const Token*& begin, const Token*& end) override;
+
+public:
+    explicit TokenPipeline(istream& input, size_t chunkBytes = 1 << 20, int depth = 4);
+    ~TokenPipeline();
+};
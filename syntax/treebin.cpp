@@ -0,0 +1,243 @@
+#include "treebin.h"
+#include "binaryio.h"
+#include "mappedfile.h"
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+static_assert(NODE_UNKNOWN < TREE_NODE_REF, "NodeKind must fit in the low 5 bits of a record tag");
+
+static const unsigned char TAG_LEFT = 0x20;
+static const unsigned char TAG_RIGHT = 0x40;
+static const unsigned char TAG_TOKEN = 0x80;
+
+namespace {
+
+// Node types are string literals, so after the first lookup a type is
+// recognised by its address instead of by comparing names.
+struct KindCache {
+    const char* names[32];
+    unsigned char kinds[32];
+
+    KindCache() {
+        for (int i = 0; i < 32; i++) names[i] = nullptr;
+    }
+
+    int kindOf(string_view type) {
+        size_t slot = ((size_t)type.data() >> 2) & 31;
+        if (names[slot] == type.data() && type.data()) return kinds[slot];
+        int kind = nodeKindOf(type);
+        names[slot] = type.data();
+        kinds[slot] = (unsigned char)kind;
+        return kind;
+    }
+};
+
+// Index of each distinct node value, open addressing over FNV-1a hashes:
+// values are short identifiers and numbers, and a tree has millions.
+struct StringTable {
+    vector<string_view> strings;
+    vector<unsigned int> slots;     // index + 1, 0 when free
+    size_t mask;
+
+    StringTable() : strings(1), slots(1024, 0), mask(1023) {}
+
+    static size_t hash(string_view text) {
+        size_t h = 2166136261u;
+        for (char c : text) h = (h ^ (unsigned char)c) * 16777619u;
+        return h;
+    }
+
+    unsigned int indexOf(string_view text) {
+        size_t slot = hash(text) & mask;
+        while (slots[slot]) {
+            if (strings[slots[slot] - 1] == text) return slots[slot] - 1;
+            slot = (slot + 1) & mask;
+        }
+        unsigned int index = (unsigned int)strings.size();
+        strings.push_back(text);
+        slots[slot] = index + 1;
+        if (strings.size() * 2 > slots.size()) grow();
+        return index;
+    }
+
+    void grow() {
+        vector<unsigned int> old(slots.size() * 2, 0);
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (unsigned int entry : old) {
+            if (!entry) continue;
+            size_t slot = hash(strings[entry - 1]) & mask;
+            while (slots[slot]) slot = (slot + 1) & mask;
+            slots[slot] = entry;
+        }
+    }
+};
+
+}
+
+bool isBinaryTreeData(string_view data) {
+    return data.size() >= sizeof(TREE_BINARY_MAGIC) &&
+        memcmp(data.data(), TREE_BINARY_MAGIC, sizeof(TREE_BINARY_MAGIC)) == 0;
+}
+
+void saveTreeBinary(const BinTree& tree, const string& filename) {
+    StringTable strings;
+    // Only the parameters of one group share a TYPE node, and they are
+    // written one after the other, so a repeat is always of the last TYPE.
+    const STNode* lastType = nullptr;
+    KindCache kinds;
+    string body;
+    unsigned int records = 0;
+    int line = 0;
+    int token = 0;
+
+    NodeStack stack;
+    if (tree.getRoot()) stack.push(tree.getRoot());
+    while (!stack.isEmpty()) {
+        STNode* node = stack.pop();
+        const STData& data = node->getData();
+        int kind = kinds.kindOf(data.type);
+        if (kind == NODE_UNKNOWN) {
+            throw runtime_error("Cannot save node type " + string(data.type) + " to " + filename);
+        }
+
+        if (kind == NODE_TYPE) {
+            if (node == lastType) {
+                body.push_back((char)TREE_NODE_REF);
+                records++;
+                continue;
+            }
+            lastType = node;
+        }
+
+        // Most structural nodes have no value; string 0 is always "".
+        unsigned int value = data.value.empty() ? 0 : strings.indexOf(data.value);
+
+        unsigned char tag = (unsigned char)kind;
+        if (node->getLeft()) tag |= TAG_LEFT;
+        if (node->getRight()) tag |= TAG_RIGHT;
+        if (data.token >= 0) tag |= TAG_TOKEN;
+        body.push_back((char)tag);
+        putVarint(body, value);
+        putVarint(body, zigzag(data.line - line));
+        line = data.line;
+        if (data.token >= 0) {
+            putVarint(body, zigzag(data.token - token));
+            token = data.token;
+        }
+        records++;
+
+        if (node->getRight()) stack.push(node->getRight());
+        if (node->getLeft()) stack.push(node->getLeft());
+    }
+
+    // Everything goes out in one write.
+    string out(TREE_BINARY_MAGIC, sizeof(TREE_BINARY_MAGIC));
+    out.push_back((char)TREE_BINARY_VERSION);
+    putVarint(out, (unsigned int)strings.strings.size());
+    putVarint(out, records);
+    for (string_view str : strings.strings) {
+        putVarint(out, (unsigned int)str.size());
+        out.append(str.data(), str.size());
+    }
+    out += body;
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        throw runtime_error("Cannot open file: " + filename);
+    }
+    file.write(out.data(), (streamsize)out.size());
+    if (!file) {
+        throw runtime_error("Cannot write file: " + filename);
+    }
+}
+
+void loadTreeBinary(const string& filename, BinTree& tree) {
+    MappedFile file(filename);
+    BinaryReader in{ (const unsigned char*)file.begin(), (const unsigned char*)file.end(), filename,
+        "binary tree file" };
+    if (!isBinaryTreeData(file.view())) {
+        throw runtime_error("Not a binary tree file: " + filename);
+    }
+    in.bytes(sizeof(TREE_BINARY_MAGIC));
+    if (in.byte() != TREE_BINARY_VERSION) {
+        throw runtime_error("Unsupported binary tree file version: " + filename);
+    }
+
+    unsigned int stringCount = in.varint();
+    unsigned int recordCount = in.varint();
+    if (stringCount > file.size() || recordCount > file.size()) in.corrupt();
+
+    tree.setRoot(nullptr);
+    tree.getArena().clear();
+
+    vector<string_view> strings(stringCount);
+    for (unsigned int i = 0; i < stringCount; i++) {
+        strings[i] = tree.storeText(in.bytes(in.varint()));
+    }
+
+    // Each record fills the slot the previous ones left open: the left
+    // child of the last node, else its right child, else the right child of
+    // the nearest ancestor still waiting for one.
+    vector<STNode*> waitingRight;
+    STNode* lastType = nullptr;
+    STNode* parent = nullptr;
+    bool toRight = false;
+    bool open = true;
+    int line = 0;
+    int token = 0;
+
+    for (unsigned int i = 0; i < recordCount; i++) {
+        if (!open) in.corrupt();
+
+        unsigned char tag = in.byte();
+        int kind = tag & 0x1F;
+        STNode* node;
+        bool hasLeft = false;
+        bool hasRight = false;
+        if (kind == TREE_NODE_REF) {
+            if (tag != TREE_NODE_REF || !lastType) in.corrupt();
+            node = lastType;
+        }
+        else {
+            if (kind >= NODE_UNKNOWN) in.corrupt();
+            unsigned int value = in.varint();
+            if (value >= stringCount) in.corrupt();
+            line += unzigzag(in.varint());
+            int nodeToken = -1;
+            if (tag & TAG_TOKEN) {
+                token += unzigzag(in.varint());
+                nodeToken = token;
+            }
+            node = tree.newNode(STData(nodeKindName(kind), strings[value], line, nodeToken));
+            hasLeft = (tag & TAG_LEFT) != 0;
+            hasRight = (tag & TAG_RIGHT) != 0;
+            if (kind == NODE_TYPE) lastType = node;
+        }
+
+        if (!parent) tree.setRoot(node);
+        else if (toRight) parent->setRight(node);
+        else parent->setLeft(node);
+
+        if (hasLeft) {
+            if (hasRight) waitingRight.push_back(node);
+            parent = node;
+            toRight = false;
+        }
+        else if (hasRight) {
+            parent = node;
+            toRight = true;
+        }
+        else if (!waitingRight.empty()) {
+            parent = waitingRight.back();
+            waitingRight.pop_back();
+            toRight = true;
+        }
+        else {
+            open = false;
+        }
+    }
+
+    if ((recordCount > 0 && open) || in.pos != in.end) in.corrupt();
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "stnode.h"
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Binary syntax tree, written once after a parse and reloaded without the
+// tokens or the parser:
+//
+//   "STRE" version:u8 stringCount:varint recordCount:varint
+//   stringCount x (length:varint bytes)
+//   recordCount x node record, in preorder
+//
+// A record starts with tag:u8: the NodeKind in the low 5 bits, then one
+// bit each for "has left child", "has right child" and "has token". The
+// rest is value:varint (string index) lineDelta:zigzag-varint and, with
+// the token bit, tokenDelta:zigzag-varint. Deltas are taken from the
+// previous record (with a token, for tokenDelta).
+//
+// The parameters of a group share one TYPE node, met one after the other.
+// A repeat is written as the lone tag TREE_NODE_REF, meaning the node of
+// the last TYPE record, so a reloaded tree shares the same nodes.
+
+const char TREE_BINARY_MAGIC[4] = { 'S', 'T', 'R', 'E' };
+const unsigned char TREE_BINARY_VERSION = 1;
+const unsigned char TREE_NODE_REF = 31;
+
+bool isBinaryTreeData(string_view data);
+
+void saveTreeBinary(const BinTree& tree, const string& filename);
+
+// Replaces tree's nodes with the ones in filename, in one pass over the
+// mapped file. Node text is copied into the tree's arena.
+void loadTreeBinary(const string& filename, BinTree& tree);
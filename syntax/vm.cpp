@@ -0,0 +1,601 @@
+#include "vm.h"
+#include "fold.h"
+#include "textwriter.h"
+#include <cstring>
+#include <unordered_map>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+static const char* const OPCODE_NAMES[OP_COUNT] = {
+    "PUSH", "LOAD_GLOBAL", "STORE_GLOBAL", "LOAD_LOCAL", "STORE_LOCAL", "LOAD_REF", "STORE_REF",
+    "ADDR_GLOBAL", "ADDR_LOCAL", "ADD", "SUB", "MUL", "DIV", "CALL", "RETURN", "POP", "WRITELN",
+    "HALT"
+};
+
+static const int OPCODE_OPERANDS[OP_COUNT] = {
+    1, 1, 1, 1, 1, 1, 1,
+    1, 1, 0, 0, 0, 1, 2, 1, 0, 1,
+    0
+};
+
+// Operand stack change; a CALL's and a WRITELN's depend on their operands.
+static const int STACK_EFFECT[OP_COUNT] = {
+    1, 1, -1, 1, -1, 1, -1,
+    1, 1, -1, -1, -1, -1, 0, 0, -1, 0,
+    0
+};
+
+const char* opcodeName(int op) {
+    return (op >= 0 && op < OP_COUNT) ? OPCODE_NAMES[op] : "?";
+}
+
+int opcodeOperands(int op) {
+    return (op >= 0 && op < OP_COUNT) ? OPCODE_OPERANDS[op] : 0;
+}
+
+namespace {
+
+enum SlotKind {
+    SLOT_GLOBAL,
+    SLOT_LOCAL,
+    SLOT_READONLY,      // a const parameter
+    SLOT_REF,           // a var parameter
+    SLOT_CONSTANT,      // index is the value
+    SLOT_FUNCTION       // index is the function
+};
+
+struct Slot {
+    SlotKind kind;
+    int index;
+};
+
+NodeKind kindOf(const STNode* node) {
+    return (NodeKind)nodeKindOf(node->getData().type);
+}
+
+class Compiler {
+private:
+    Bytecode program;
+    vector<vector<bool>> refParams;     // per function, which parameters are var
+    unordered_map<string_view, Slot> globals;
+    unordered_map<string_view, Slot> locals;
+    int function;       // being compiled, or -1 in the main block
+    int nextLocal;
+
+    vector<int> mainCode;
+    vector<int>* out;
+    int depth;
+    int maxDepth;
+    vector<const STNode*> spine;
+
+    [[noreturn]] void fail(const STNode* node, const string& message) {
+        throw runtime_error("Compile error at line " + to_string(node->getData().line) + ": " + message);
+    }
+
+    void emit(int op, int effect) {
+        out->push_back(op);
+        depth += effect;
+        if (depth > maxDepth) maxDepth = depth;
+    }
+
+    void emit(int op) { emit(op, STACK_EFFECT[op]); }
+    void emit1(int op, int a) { emit(op); out->push_back(a); }
+
+    const Slot* lookup(const STNode* id) const {
+        string_view name = id->getData().value;
+        if (function >= 0) {
+            auto local = locals.find(name);
+            if (local != locals.end()) return &local->second;
+        }
+        auto global = globals.find(name);
+        return global != globals.end() ? &global->second : nullptr;
+    }
+
+    const Slot& resolve(const STNode* id) {
+        const Slot* slot = lookup(id);
+        if (!slot) fail(id, "undeclared identifier '" + string(id->getData().value) + "'");
+        return *slot;
+    }
+
+    void declare(const STNode* id, Slot slot) {
+        (function >= 0 ? locals : globals)[id->getData().value] = slot;
+    }
+
+    void declareVariable(const STNode* id) {
+        if (function >= 0) declare(id, Slot{ SLOT_LOCAL, nextLocal++ });
+        else declare(id, Slot{ SLOT_GLOBAL, program.globals++ });
+    }
+
+    int numberValue(const STNode* literal) {
+        int value;
+        if (!literalValue(literal->getData(), value)) {
+            fail(literal, "number '" + string(literal->getData().value) + "' does not fit in 32 bits");
+        }
+        return value;
+    }
+
+    const BytecodeFunction& functionAt(const Slot& slot) const { return program.functions[slot.index]; }
+
+    void compileCall(const STNode* name, const STNode* args) {
+        const Slot& slot = resolve(name);
+        if (slot.kind != SLOT_FUNCTION) fail(name, "'" + string(name->getData().value) + "' is not a function");
+        const BytecodeFunction& callee = functionAt(slot);
+        const vector<bool>& refs = refParams[slot.index];
+
+        // A SEQ chain of PARAM_VAL wrappers, each with its argument on the left.
+        int count = 0;
+        while (args) {
+            const STNode* wrapper = args;
+            if (kindOf(args) == NODE_SEQ) {
+                wrapper = args->getLeft();
+                args = args->getRight();
+            }
+            else {
+                args = nullptr;
+            }
+            if (count < callee.params && refs[count]) {
+                compileAddress(wrapper->getLeft() ? wrapper->getLeft() : name, callee, count);
+            }
+            else {
+                compileExpression(wrapper->getLeft());
+            }
+            count++;
+        }
+        if (count != callee.params) {
+            fail(name, "'" + callee.name + "' expects " + to_string(callee.params) + " arguments, but " +
+                to_string(count) + " were provided");
+        }
+        emit(OP_CALL, 1 - count);
+        out->push_back(slot.index);
+        out->push_back(name->getData().line);
+    }
+
+    // The address a var parameter receives.
+    void compileAddress(const STNode* arg, const BytecodeFunction& callee, int index) {
+        const Slot* slot = kindOf(arg) == NODE_ID ? &resolve(arg) : nullptr;
+        if (slot && slot->kind == SLOT_GLOBAL) emit1(OP_ADDR_GLOBAL, slot->index);
+        else if (slot && slot->kind == SLOT_LOCAL) emit1(OP_ADDR_LOCAL, slot->index);
+        else if (slot && slot->kind == SLOT_REF) emit1(OP_LOAD_LOCAL, slot->index);
+        else if (slot && slot->kind == SLOT_FUNCTION && slot->index == function) {
+            emit1(OP_ADDR_LOCAL, program.functions[function].params);
+        }
+        else {
+            fail(arg, "argument " + to_string(index + 1) + " of '" + callee.name +
+                "' is a var parameter and needs a variable");
+        }
+    }
+
+    void compileOperand(const STNode* node) {
+        switch (kindOf(node)) {
+        case NODE_DECNUM:
+        case NODE_HEXNUM:
+            emit1(OP_PUSH, numberValue(node));
+            return;
+        case NODE_FUNC_CALL:
+            compileCall(node->getLeft(), node->getRight());
+            return;
+        case NODE_ID:
+            break;
+        default:
+            fail(node, "unexpected " + string(node->getData().type) + " in an expression");
+        }
+
+        const Slot& slot = resolve(node);
+        switch (slot.kind) {
+        case SLOT_GLOBAL: emit1(OP_LOAD_GLOBAL, slot.index); break;
+        case SLOT_LOCAL:
+        case SLOT_READONLY: emit1(OP_LOAD_LOCAL, slot.index); break;
+        case SLOT_REF: emit1(OP_LOAD_REF, slot.index); break;
+        case SLOT_CONSTANT: emit1(OP_PUSH, slot.index); break;
+        case SLOT_FUNCTION:
+            // Inside a function its name is the result so far; elsewhere
+            // a bare name calls it without arguments.
+            if (slot.index == function) emit1(OP_LOAD_LOCAL, program.functions[function].params);
+            else compileCall(node, nullptr);
+            break;
+        }
+    }
+
+    // The parser builds a + b + c ... in a loop, so left spines get as
+    // long as the input; only right operands recurse.
+    void compileExpression(const STNode* node) {
+        if (!node) throw runtime_error("Compile error: missing expression");
+        size_t base = spine.size();
+        while (kindOf(node) == NODE_BIN_OP) {
+            spine.push_back(node);
+            node = node->getLeft();
+            if (!node) throw runtime_error("Compile error: missing operand");
+        }
+        compileOperand(node);
+
+        while (spine.size() > base) {
+            const STNode* op = spine.back();
+            spine.pop_back();
+            compileExpression(op->getRight());
+            string_view text = op->getData().value;
+            if (text == "+") emit(OP_ADD);
+            else if (text == "-") emit(OP_SUB);
+            else if (text == "*") emit(OP_MUL);
+            else if (text == "/" || text == "div") {
+                emit1(OP_DIV, op->getData().line);
+            }
+            else fail(op, "unknown operator '" + string(text) + "'");
+        }
+    }
+
+    void compileAssign(const STNode* node) {
+        compileExpression(node->getRight());
+        const STNode* target = node->getLeft();
+        const Slot& slot = resolve(target);
+        string name(target->getData().value);
+        switch (slot.kind) {
+        case SLOT_GLOBAL: emit1(OP_STORE_GLOBAL, slot.index); break;
+        case SLOT_LOCAL: emit1(OP_STORE_LOCAL, slot.index); break;
+        case SLOT_REF: emit1(OP_STORE_REF, slot.index); break;
+        case SLOT_READONLY: fail(target, "cannot assign to const parameter '" + name + "'");
+        case SLOT_CONSTANT: fail(target, "cannot assign to constant '" + name + "'");
+        case SLOT_FUNCTION:
+            if (slot.index != function) fail(target, "cannot assign to function '" + name + "' outside it");
+            emit1(OP_STORE_LOCAL, program.functions[function].params);
+            break;
+        }
+    }
+
+    // The arguments chain through right links: an ID or number's own, or
+    // a SEQ's holding the argument on its left. Anything else is the last
+    // argument, whole. All of them are on the stack before anything is
+    // written.
+    void compileWriteln(const STNode* node) {
+        int count = 0;
+        for (const STNode* arg = node->getRight(); arg; count++) {
+            NodeKind kind = kindOf(arg);
+            if (kind == NODE_SEQ) {
+                compileExpression(arg->getLeft());
+                arg = arg->getRight();
+            }
+            else if (kind == NODE_ID || kind == NODE_DECNUM || kind == NODE_HEXNUM) {
+                compileOperand(arg);
+                arg = arg->getRight();
+            }
+            else {
+                compileExpression(arg);
+                arg = nullptr;
+            }
+        }
+        emit(OP_WRITELN, -count);
+        out->push_back(count);
+    }
+
+    void compileFunction(const STNode* node) {
+        const STNode* name = node->getLeft();
+        BytecodeFunction callee{ string(name->getData().value), 0, 0, 0, 0 };
+        int index = (int)program.functions.size();
+        declare(name, Slot{ SLOT_FUNCTION, index });
+
+        // right: SEQ(params, SEQ(TYPE, body)) or SEQ(TYPE, body).
+        const STNode* right = node->getRight();
+        const STNode* params = nullptr;
+        if (right && right->getLeft() && kindOf(right->getLeft()) != NODE_TYPE) {
+            params = right->getLeft();
+            right = right->getRight();
+        }
+        const STNode* body = right ? right->getRight() : nullptr;
+
+        int outerDepth = depth;
+        int outerMaxDepth = maxDepth;
+        function = index;
+        locals.clear();
+        vector<bool> refs;
+        NodeStack stack;
+        stack.push(const_cast<STNode*>(params));
+        while (!stack.isEmpty()) {
+            STNode* param = stack.pop();
+            NodeKind kind = kindOf(param);
+            if (kind == NODE_SEQ) {
+                stack.push(param->getRight());
+                stack.push(param->getLeft());
+                continue;
+            }
+            SlotKind slot = kind == NODE_PARAM_VAR ? SLOT_REF : kind == NODE_PARAM_CONST ? SLOT_READONLY : SLOT_LOCAL;
+            declare(param->getLeft(), Slot{ slot, (int)refs.size() });
+            refs.push_back(slot == SLOT_REF);
+        }
+        callee.params = (int)refs.size();
+        nextLocal = callee.params + 1;
+        program.functions.push_back(callee);
+        refParams.push_back(refs);
+
+        out = &program.code;
+        depth = maxDepth = 0;
+        program.functions[index].entry = (int)program.code.size();
+        compileBlock(body);
+        emit1(OP_RETURN, callee.params);
+        program.functions[index].frameSize = nextLocal;
+        program.functions[index].maxStack = maxDepth;
+
+        function = -1;
+        locals.clear();
+        out = &mainCode;
+        depth = outerDepth;
+        maxDepth = outerMaxDepth;
+    }
+
+    // Declarations and statements in source order: a preorder walk, which
+    // also keeps long statement chains off the call stack.
+    void compileBlock(const STNode* root) {
+        NodeStack stack;
+        stack.push(const_cast<STNode*>(root));
+        while (!stack.isEmpty()) {
+            STNode* node = stack.pop();
+            switch (kindOf(node)) {
+            case NODE_PROGRAM:
+                if (node->getLeft()) declareVariable(node->getLeft());
+                stack.push(node->getRight());
+                break;
+            case NODE_SEQ:
+                stack.push(node->getRight());
+                stack.push(node->getLeft());
+                break;
+            case NODE_COMPOUND_STMT:
+                stack.push(node->getLeft());
+                break;
+            case NODE_VAR_DECL:
+                declareVariable(node->getLeft());
+                break;
+            case NODE_CONST_DECL:
+                declare(node->getLeft(), Slot{ SLOT_CONSTANT, numberValue(node->getRight()) });
+                break;
+            case NODE_FUNCTION:
+                compileFunction(node);
+                break;
+            case NODE_ASSIGN:
+                compileAssign(node);
+                break;
+            case NODE_FUNC_CALL:
+                compileCall(node->getLeft(), node->getRight());
+                emit(OP_POP);
+                break;
+            case NODE_WRITELN:
+                compileWriteln(node);
+                break;
+            default:
+                fail(node, "unexpected " + string(node->getData().type));
+            }
+        }
+    }
+
+public:
+    Compiler() : function(-1), nextLocal(0), out(&mainCode), depth(0), maxDepth(0) {
+        program.globals = 0;
+        program.entry = 0;
+        program.maxStack = 0;
+    }
+
+    Bytecode compile(const BinTree& tree) {
+        if (!tree.getRoot()) throw runtime_error("Compile error: the syntax tree is empty");
+        compileBlock(tree.getRoot());
+        out->push_back(OP_HALT);
+        program.entry = (int)program.code.size();
+        program.maxStack = maxDepth;
+        program.code.insert(program.code.end(), mainCode.begin(), mainCode.end());
+        return program;
+    }
+};
+
+struct CallFrame {
+    const int* returnTo;
+    int fp;
+    int top;
+};
+
+// Digits of value, written backwards ending at end.
+char* formatInt(int value, char* end) {
+    unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    char* p = end;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) *--p = '-';
+    return p;
+}
+
+[[noreturn]] void runtimeError(int line, const char* message) {
+    throw runtime_error("Runtime error at line " + to_string(line) + ": " + message);
+}
+
+}
+
+Bytecode compileProgram(const BinTree& tree) {
+    Compiler compiler;
+    return compiler.compile(tree);
+}
+
+void runBytecode(const Bytecode& program, ostream& output) {
+    TextWriter out(output);
+    const int* code = program.code.data();
+    const BytecodeFunction* functions = program.functions.data();
+
+    // Globals first, then one frame per active call.
+    vector<int> memoryStore((size_t)program.globals + 1024, 0);
+    vector<int> stackStore((size_t)program.maxStack + 1024);
+    vector<CallFrame> calls;
+    int* memory = memoryStore.data();
+    int* stackBase = stackStore.data();
+    int* sp = stackBase;
+    int fp = 0;
+    int top = program.globals;
+    const int* pc = code + program.entry;
+
+#ifdef VM_COMPUTED_GOTO
+    static void* const labels[OP_COUNT] = {
+        &&L_PUSH, &&L_LOAD_GLOBAL, &&L_STORE_GLOBAL, &&L_LOAD_LOCAL, &&L_STORE_LOCAL, &&L_LOAD_REF,
+        &&L_STORE_REF, &&L_ADDR_GLOBAL, &&L_ADDR_LOCAL, &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIV, &&L_CALL,
+        &&L_RETURN, &&L_POP, &&L_WRITELN, &&L_HALT
+    };
+#define VM_CASE(name) L_##name:
+#define VM_NEXT goto *labels[*pc++]
+    VM_NEXT;
+#else
+#define VM_CASE(name) case OP_##name:
+#define VM_NEXT continue
+    for (;;) {
+        switch (*pc++) {
+#endif
+
+    VM_CASE(PUSH) {
+        *sp++ = *pc++;
+        VM_NEXT;
+    }
+    VM_CASE(LOAD_GLOBAL) {
+        *sp++ = memory[*pc++];
+        VM_NEXT;
+    }
+    VM_CASE(STORE_GLOBAL) {
+        memory[*pc++] = *--sp;
+        VM_NEXT;
+    }
+    VM_CASE(LOAD_LOCAL) {
+        *sp++ = memory[fp + *pc++];
+        VM_NEXT;
+    }
+    VM_CASE(STORE_LOCAL) {
+        memory[fp + *pc++] = *--sp;
+        VM_NEXT;
+    }
+    VM_CASE(LOAD_REF) {
+        *sp++ = memory[memory[fp + *pc++]];
+        VM_NEXT;
+    }
+    VM_CASE(STORE_REF) {
+        memory[memory[fp + *pc++]] = *--sp;
+        VM_NEXT;
+    }
+    VM_CASE(ADDR_GLOBAL) {
+        *sp++ = *pc++;
+        VM_NEXT;
+    }
+    VM_CASE(ADDR_LOCAL) {
+        *sp++ = fp + *pc++;
+        VM_NEXT;
+    }
+    VM_CASE(ADD) {
+        sp--;
+        sp[-1] = wrapAdd(sp[-1], sp[0]);
+        VM_NEXT;
+    }
+    VM_CASE(SUB) {
+        sp--;
+        sp[-1] = wrapSub(sp[-1], sp[0]);
+        VM_NEXT;
+    }
+    VM_CASE(MUL) {
+        sp--;
+        sp[-1] = wrapMul(sp[-1], sp[0]);
+        VM_NEXT;
+    }
+    VM_CASE(DIV) {
+        int line = *pc++;
+        sp--;
+        if (sp[0] == 0) runtimeError(line, "division by zero");
+        sp[-1] = wrapDiv(sp[-1], sp[0]);
+        VM_NEXT;
+    }
+    VM_CASE(CALL) {
+        const BytecodeFunction& callee = functions[pc[0]];
+        int line = pc[1];
+        pc += 2;
+        if (calls.size() >= (size_t)VM_MAX_CALL_DEPTH) runtimeError(line, "calls nested too deep");
+
+        int base = top;
+        if ((size_t)(base + callee.frameSize) > memoryStore.size()) {
+            memoryStore.resize(memoryStore.size() * 2 + callee.frameSize);
+            memory = memoryStore.data();
+        }
+        sp -= callee.params;
+        if ((size_t)(sp - stackBase) + callee.maxStack + 1 > stackStore.size()) {
+            ptrdiff_t used = sp - stackBase;
+            stackStore.resize(stackStore.size() * 2 + callee.maxStack);
+            stackBase = stackStore.data();
+            sp = stackBase + used;
+        }
+        memcpy(memory + base, sp, sizeof(int) * callee.params);
+        memset(memory + base + callee.params, 0, sizeof(int) * (callee.frameSize - callee.params));
+
+        calls.push_back(CallFrame{ pc, fp, top });
+        fp = base;
+        top = base + callee.frameSize;
+        pc = code + callee.entry;
+        VM_NEXT;
+    }
+    VM_CASE(RETURN) {
+        int result = memory[fp + *pc];
+        const CallFrame& frame = calls.back();
+        pc = frame.returnTo;
+        fp = frame.fp;
+        top = frame.top;
+        calls.pop_back();
+        *sp++ = result;
+        VM_NEXT;
+    }
+    VM_CASE(POP) {
+        sp--;
+        VM_NEXT;
+    }
+    VM_CASE(WRITELN) {
+        int count = *pc++;
+        sp -= count;
+        for (int i = 0; i < count; i++) {
+            if (i) out.put(' ');
+            char digits[12];
+            char* end = digits + sizeof(digits);
+            char* begin = formatInt(sp[i], end);
+            out.put(string_view(begin, end - begin));
+        }
+        out.put('\n');
+        VM_NEXT;
+    }
+    VM_CASE(HALT) {
+        out.flush();
+        return;
+    }
+
+#ifndef VM_COMPUTED_GOTO
+        default:
+            throw runtime_error("Runtime error: bad opcode " + to_string(pc[-1]));
+        }
+    }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+}
+
+void printBytecode(const Bytecode& program, ostream& out) {
+    vector<string> labels(program.code.size());
+    for (const BytecodeFunction& function : program.functions) {
+        labels[function.entry] = function.name + " (params " + to_string(function.params) + ", frame " +
+            to_string(function.frameSize) + ", stack " + to_string(function.maxStack) + "):";
+    }
+    if ((size_t)program.entry < labels.size()) {
+        labels[program.entry] = "main (globals " + to_string(program.globals) + ", stack " +
+            to_string(program.maxStack) + "):";
+    }
+
+    for (size_t pc = 0; pc < program.code.size(); ) {
+        if (!labels[pc].empty()) out << labels[pc] << "\n";
+        int op = program.code[pc];
+        out << "  " << pc << "\t" << opcodeName(op);
+        for (int i = 1; i <= opcodeOperands(op) && pc + i < program.code.size(); i++) {
+            out << " " << program.code[pc + i];
+        }
+        if (op == OP_CALL && pc + 1 < program.code.size()) {
+            int callee = program.code[pc + 1];
+            if (callee >= 0 && callee < (int)program.functions.size()) out << "\t; " << program.functions[callee].name;
+        }
+        out << "\n";
+        pc += 1 + opcodeOperands(op);
+    }
+    out.flush();
+}
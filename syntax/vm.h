@@ -0,0 +1,80 @@
+#pragma once
+#include "stnode.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Each instruction is an opcode word followed by its operand words. Slots
+// are resolved at compile time: a global by its index, a parameter or
+// local by its offset in the frame.
+enum Opcode : int {
+    OP_PUSH,            // value
+    OP_LOAD_GLOBAL,     // slot
+    OP_STORE_GLOBAL,    // slot
+    OP_LOAD_LOCAL,      // frame slot
+    OP_STORE_LOCAL,     // frame slot
+    OP_LOAD_REF,        // frame slot holding the address of a var argument
+    OP_STORE_REF,       // frame slot, likewise
+    OP_ADDR_GLOBAL,     // slot; pushes its address for a var parameter
+    OP_ADDR_LOCAL,      // frame slot, likewise
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,             // line, reported on division by zero
+    OP_CALL,            // function, line
+    OP_RETURN,          // frame slot of the result
+    OP_POP,
+    OP_WRITELN,         // count; writes that many values as one line
+    OP_HALT,
+    OP_COUNT
+};
+
+const char* opcodeName(int op);
+int opcodeOperands(int op);
+
+// A function's frame: parameters in slots [0, params), the result in slot
+// params, then the locals. A var parameter's slot holds an address.
+struct BytecodeFunction {
+    string name;
+    int entry;
+    int params;
+    int frameSize;
+    int maxStack;       // operand stack the body needs, not counting callees
+};
+
+struct Bytecode {
+    vector<int> code;
+    vector<BytecodeFunction> functions;
+    int globals;
+    int entry;          // the main block, after every function
+    int maxStack;       // of the main block
+};
+
+const int VM_MAX_CALL_DEPTH = 100000;
+
+// Compiles a parsed, and possibly folded, program. Throws
+// runtime_error("Compile error at line N: ...") for what the parser lets
+// through but nothing could run: a var argument that is not a variable,
+// a call of something that is not a function, an assignment to a const
+// parameter or to a function other than the one being compiled, or a
+// number that does not fit in 32 bits.
+Bytecode compileProgram(const BinTree& tree);
+
+// Runs the main block. A writeln evaluates all its arguments, so lines
+// written by calls among them come first, and then writes the values to
+// out on one line, separated by spaces. Arithmetic wraps at 32 bits and
+// / truncates like div. Division by zero and calls nested deeper than
+// VM_MAX_CALL_DEPTH throw runtime_error("Runtime error at line N: ..."),
+// after the output so far.
+void runBytecode(const Bytecode& program, ostream& out);
+
+void printBytecode(const Bytecode& program, ostream& out);
+
+// The VM's arithmetic, shared with anything that must agree with it.
+inline int wrapAdd(int a, int b) { return (int)((unsigned)a + (unsigned)b); }
+inline int wrapSub(int a, int b) { return (int)((unsigned)a - (unsigned)b); }
+inline int wrapMul(int a, int b) { return (int)((unsigned)a * (unsigned)b); }
+// b must not be 0; INT_MIN div -1 wraps to INT_MIN.
+inline int wrapDiv(int a, int b) { return b == -1 ? (int)(0u - (unsigned)a) : a / b; }